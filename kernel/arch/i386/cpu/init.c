@@ -51,6 +51,8 @@ void x86_cpu_init(void)
     /* parse command line */
     kargs_parse(boot->cmdline);
 
+    mm_zero_pool_setup();
+
     /* reinit early console */
     earlycon_reinit();
 
@@ -71,6 +71,7 @@ struct x86_cpu {
 
 /* CR4 */
 #define CR4_PSE _BV(4)
+#define CR4_PGE _BV(7)
 
 /* CPU function */
 static inline uintptr_t read_cr0(void)
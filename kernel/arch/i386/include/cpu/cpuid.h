@@ -61,6 +61,24 @@ static inline int x86_cpuid_features(struct x86_cpuid_features *features)
 }
 #endif
 
+/* CPUID.01H:EDX feature flags */
+#define CPUID_EDX_PSE   _BV(3)      /* Page Size Extensions */
+#define CPUID_EDX_PGE   _BV(13)     /* Page Global Enable */
+#define CPUID_EDX_SSE2  _BV(26)     /* SSE2 instructions (movnti) */
+
+int x86_cpuid_check(void);
+
+static inline uint32_t x86_cpuid_features_edx(void)
+{
+    uint32_t eax = 1, ebx, ecx, edx;
+
+    if (!x86_cpuid_check())
+        return 0;
+
+    asm volatile("cpuid":"+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return edx;
+}
+
 static inline int x86_cpuid_vendor(union x86_cpuid_vendor *vendor)
 {
     asm volatile("cpuid":
@@ -10,9 +10,17 @@
 #if ARCH_BITS==32
 #define ARCH_KVMEM_BASE        (0xD0000000UL)
 #define ARCH_KVMEM_NODES_SIZE  (0x00100000UL)
+#define ARCH_KVMEM_SLAB_BASE   (0xDC000000UL)
+#define ARCH_KVMEM_SLAB_SIZE   (0x04000000UL)  /* 64 MiB */
+#define ARCH_VM_PAGES_BASE     (0xF0000000UL)
+#define ARCH_VM_PAGES_SIZE     (0x04000000UL)  /* 64 MiB */
 #else
 #define ARCH_KVMEM_BASE        (0xFFFFD00000000000ULL)
 #define ARCH_KVMEM_NODES_SIZE  (0x00100000ULL)
+#define ARCH_KVMEM_SLAB_BASE   (0xFFFFD0000C000000ULL)
+#define ARCH_KVMEM_SLAB_SIZE   (0x0000000004000000ULL)  /* 64 MiB */
+#define ARCH_VM_PAGES_BASE     (0xFFFFD00010000000ULL)
+#define ARCH_VM_PAGES_SIZE     (0x0000000004000000ULL)  /* 64 MiB */
 #endif
 
 extern char _VMA; /* Must be defined in linker script */
@@ -24,6 +32,19 @@ static inline void tlb_flush(void)
     write_cr3(read_cr3());
 }
 
+/* like tlb_flush, also dropping global (kernel) entries */
+static inline void tlb_flush_global(void)
+{
+    uintptr_t cr4 = read_cr4();
+
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        tlb_flush();
+    }
+}
+
 #if ARCH_BITS==32
 typedef uint32_t paddr_t;
 typedef uint32_t vaddr_t;
@@ -4,6 +4,9 @@
 struct pmap {
     paddr_t map;
     size_t  ref;
+
+    size_t  resident;   /* user pages mapped */
+    size_t  tables;     /* user page tables */
 };
 
 #include_next <mm/pmap.h>
@@ -1,3 +1,3 @@
 obj-y  			   += mm.o
-obj-$(ARCH_I386)   += i386.o
+obj-$(ARCH_I386)   += i386.o page.o
 obj-$(ARCH_X86_64) += x86_64.o
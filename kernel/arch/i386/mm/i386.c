@@ -27,6 +27,12 @@ MALLOC_DEFINE(M_PMAP, "pmap", "physical memory map structure");
 
 static struct pmap *cur_pmap = NULL;
 
+/* 4 MiB pages are supported and enabled */
+static int pse = 0;
+
+/* set in kernel mappings once global pages are enabled */
+static uint32_t pg_global = 0;
+
 static volatile uint32_t *bootstrap_processor_table = NULL;
 static volatile uint32_t last_page_table[1024] __aligned(PAGE_SIZE) = {0};
 
@@ -61,13 +67,14 @@ static inline uintptr_t frame_mount(uintptr_t paddr)
 
 static inline uintptr_t frame_get(void)
 {
-    struct vm_page *vm_page = mm_page_alloc();
-    uintptr_t frame = vm_page->paddr; //buddy_alloc(BUDDY_ZONE_NORMAL, PAGE_SIZE);
+    struct vm_page *vm_page = mm_page_alloc(MM_NORECLAIM);
 
-    if (!frame) {
+    if (!vm_page) {
         panic("Could not allocate frame");
     }
 
+    uintptr_t frame = vm_page->paddr; //buddy_alloc(BUDDY_ZONE_NORMAL, PAGE_SIZE);
+
     uintptr_t old = frame_mount(frame);
     memset(MOUNT_ADDR, 0, PAGE_SIZE);
     frame_mount(old);
@@ -77,13 +84,14 @@ static inline uintptr_t frame_get(void)
 
 static inline uintptr_t frame_get_no_clr(void)
 {
-    struct vm_page *vm_page = mm_page_alloc();
-    uintptr_t frame = vm_page->paddr; //buddy_alloc(BUDDY_ZONE_NORMAL, PAGE_SIZE);
+    struct vm_page *vm_page = mm_page_alloc(MM_NORECLAIM);
 
-    if (!frame) {
+    if (!vm_page) {
         panic("Could not allocate frame");
     }
 
+    uintptr_t frame = vm_page->paddr; //buddy_alloc(BUDDY_ZONE_NORMAL, PAGE_SIZE);
+
     return frame;
 }
 
@@ -92,6 +100,111 @@ static void frame_release(uintptr_t i)
     buddy_free(BUDDY_ZONE_NORMAL, i, PAGE_SIZE);
 }
 
+/* ================== Foreign Page Tables ================== */
+
+/*
+ * Page tables are edited without switching address spaces: the kernel
+ * half and the user half of the loaded pmap are reached through the
+ * recursive self-map, the user half of any other pmap through the
+ * directory and table windows below.
+ */
+#define DIR_WINDOW  ((uint32_t *) 0xFFBFD000)
+#define TBL_WINDOW  ((uint32_t *) 0xFFBFE000)
+
+/* source and destination of page copies and zeroing (per CPU with SMP) */
+#define SRC_WINDOW  ((void *) 0xFFBFB000)
+#define DST_WINDOW  ((void *) 0xFFBFC000)
+
+static inline void window_map(void *window, paddr_t paddr)
+{
+    uint32_t page = paddr | PG_PRESENT | PG_WRITE;
+    size_t idx = VTBL((uintptr_t) window);
+
+    if (last_page_table[idx] != page) {
+        last_page_table[idx] = page;
+        tlb_invalidate_page((uintptr_t) window);
+    }
+}
+
+static inline int pmap_live(struct pmap *pmap, size_t pdidx)
+{
+    return pdidx >= 768 || pmap == cur_pmap || (cur_pmap && cur_pmap->map == pmap->map);
+}
+
+/* directory entry `pdidx` of `pmap` */
+static inline uint32_t *pde_get(struct pmap *pmap, size_t pdidx)
+{
+    if (pmap_live(pmap, pdidx))
+        return &PAGE_DIR[pdidx];
+
+    window_map(DIR_WINDOW, pmap->map);
+    return &DIR_WINDOW[pdidx];
+}
+
+/* page table `pdidx` of `pmap`, the directory entry must be present */
+static inline uint32_t *table_get(struct pmap *pmap, size_t pdidx)
+{
+    if (pmap_live(pmap, pdidx))
+        return PAGE_TBL(pdidx);
+
+    window_map(TBL_WINDOW, PHYSADDR(*pde_get(pmap, pdidx)));
+    return TBL_WINDOW;
+}
+
+static inline void pmap_invalidate(struct pmap *pmap, vaddr_t va)
+{
+    /* nothing of a foreign pmap is cached, the TLB is flushed as it is loaded */
+    if (pmap_live(pmap, VDIR(va)))
+        tlb_invalidate_page(va);
+}
+
+/* ================== TLB Gather ================== */
+
+/*
+ * Invalidations of pages are collected while page tables are edited and
+ * issued once the operation is done: page by page for a few pages, one
+ * flush past `TLB_GATHER_NR`. Shootdowns to other CPUs belong here too.
+ */
+#define TLB_GATHER_NR   32
+
+struct tlb_gather {
+    size_t  nr;
+    int     global;     /* kernel (global) pages were changed */
+    vaddr_t pages[TLB_GATHER_NR];
+};
+
+#define TLB_GATHER_INIT {.nr = 0, .global = 0}
+
+static inline void tlb_gather_add(struct tlb_gather *tlb, struct pmap *pmap, vaddr_t va)
+{
+    if (!pmap_live(pmap, VDIR(va)))
+        return;
+
+    if (VDIR(va) >= 768)
+        tlb->global = 1;
+
+    if (tlb->nr < TLB_GATHER_NR)
+        tlb->pages[tlb->nr] = va;
+
+    tlb->nr++;
+}
+
+static void tlb_gather_flush(struct tlb_gather *tlb)
+{
+    if (tlb->nr > TLB_GATHER_NR) {
+        if (tlb->global)
+            tlb_flush_global();
+        else
+            tlb_flush();
+    } else {
+        for (size_t i = 0; i < tlb->nr; ++i)
+            tlb_invalidate_page(tlb->pages[i]);
+    }
+
+    tlb->nr = 0;
+    tlb->global = 0;
+}
+
 /* ================== Table Helpers ================== */
 
 static inline paddr_t table_alloc(void)
@@ -110,93 +223,146 @@ static inline void table_dealloc(paddr_t paddr)
     frame_release(paddr);
 }
 
-static inline int table_map(paddr_t paddr, size_t pdidx, int flags)
+static inline int table_map(struct pmap *pmap, paddr_t paddr, size_t pdidx)
 {
     if (pdidx > 1023)
         return -EINVAL;
 
-    uint32_t table;
-    table  = paddr | (PG_PRESENT|PG_WRITE|PG_USER);
-    PAGE_DIR[pdidx] = table;
+    *pde_get(pmap, pdidx) = paddr | (PG_PRESENT|PG_WRITE|PG_USER);
 
-    tlb_flush();
+    if (pdidx < 768)
+        pmap->tables++;
+
+    /* self-map of the new table */
+    pmap_invalidate(pmap, (vaddr_t) PAGE_TBL(pdidx));
 
     return 0;
 }
 
-static inline void table_unmap(size_t pdidx)
+static inline void table_unmap(struct pmap *pmap, size_t pdidx)
 {
     if (pdidx > 1023)
         return;
 
-    if (PAGE_DIR[pdidx] & PG_PRESENT) {
-        PAGE_DIR[pdidx] &= ~PG_PRESENT;
-        table_dealloc(PAGE_DIR[pdidx] & ~PAGE_MASK);
+    uint32_t *pde = pde_get(pmap, pdidx);
+
+    if (*pde & PG_PRESENT) {
+        paddr_t table = PHYSADDR(*pde);
+        *pde = 0;
+        table_dealloc(table);
+
+        if (pdidx < 768)
+            pmap->tables--;
     }
 
-    tlb_flush();
+    pmap_invalidate(pmap, (vaddr_t) PAGE_TBL(pdidx));
+}
+
+static inline int table_large(struct pmap *pmap, size_t pdidx)
+{
+    return (*pde_get(pmap, pdidx) & (PG_PRESENT|PG_LARGE)) == (PG_PRESENT|PG_LARGE);
+}
+
+/* replace a large page with a table mapping the same memory in 4K pages */
+static void table_split(struct pmap *pmap, size_t pdidx)
+{
+    uint32_t large = *pde_get(pmap, pdidx);
+    paddr_t base = large & ~TABLE_MASK;
+    uint32_t flags = large & (PG_WRITE|PG_USER|PG_GLOBAL);
+
+    /* fill the table before installing it, the large page may hold the
+     * code or data we are running on */
+    paddr_t table = table_alloc();
+
+    uintptr_t mnt = frame_mount(table);
+    uint32_t *_pages = MOUNT_ADDR;
+
+    for (int i = 0; i < 1024; ++i)
+        _pages[i] = (base + i * PAGE_SIZE) | flags | PG_PRESENT;
+
+    frame_mount(mnt);
+
+    /* one reference per present page */
+    mm_page(table)->ref = 1024;
+
+    *pde_get(pmap, pdidx) = table | PG_PRESENT | PG_WRITE | PG_USER;
+
+    if (pdidx < 768)
+        pmap->tables++;
+
+    if (pdidx >= 768)
+        tlb_flush_global();
+    else if (pmap_live(pmap, pdidx))
+        tlb_flush();
 }
 
 /* ================== Page Helpers ================== */
-static inline int page_map(paddr_t paddr, size_t pdidx, size_t ptidx, int flags)
+static inline int page_map(struct pmap *pmap, struct tlb_gather *tlb, paddr_t paddr, vaddr_t vaddr, int flags)
 {
-    /* Sanity checking */
-    if (pdidx > 1023 || ptidx > 1023) {
-        return -EINVAL;
-    }
+    size_t pdidx = VDIR(vaddr);
+    size_t ptidx = VTBL(vaddr);
 
     uint32_t page;
 
     page  = paddr | PG_PRESENT;
     page |= flags & (VM_KW | VM_UW)? PG_WRITE : 0;
     page |= flags & (VM_URWX)? PG_USER : 0;
+    page |= pdidx >= 768? pg_global : 0;
+
+    if (table_large(pmap, pdidx))
+        table_split(pmap, pdidx);
 
     /* Check if table is present */
-    if (!(PAGE_DIR[pdidx] & PG_PRESENT)) {
-        //struct vm_page *vm_page = mm_page_alloc();
-        //paddr_t table = vm_page->paddr; //table_alloc();
+    if (!(*pde_get(pmap, pdidx) & PG_PRESENT)) {
         paddr_t table = table_alloc();
-
-        table_map(table, pdidx, flags);
+        table_map(pmap, table, pdidx);
     }
 
-    PAGE_TBL(pdidx)[ptidx] = page;
+    uint32_t *pte = &table_get(pmap, pdidx)[ptidx];
+    int present = *pte & PG_PRESENT;
+
+    *pte = page;
+
+    /* Increment references to table, once per present page */
+    if (!present) {
+        mm_page_incref(PHYSADDR(*pde_get(pmap, pdidx)));
 
-    /* Increment references to table */
-    paddr_t table = PHYSADDR(PAGE_DIR[pdidx]);
-    mm_page_incref(table);
+        if (pdidx < 768)
+            pmap->resident++;
+    } else
+        tlb_gather_add(tlb, pmap, vaddr);
 
     return 0;
 }
 
-static inline int page_protect(size_t pdidx, size_t ptidx, uint32_t flags)
+static inline int page_protect(struct pmap *pmap, struct tlb_gather *tlb, vaddr_t vaddr, uint32_t flags)
 {
-    /* Sanity checking */
-    if (pdidx > 1023 || ptidx > 1023) {
-        return -EINVAL;
-    }
-
-    uint32_t page;
+    size_t pdidx = VDIR(vaddr);
+    size_t ptidx = VTBL(vaddr);
 
     /* Check if table is present */
-    if (!(PAGE_DIR[pdidx] & PG_PRESENT)) {
+    if (!(*pde_get(pmap, pdidx) & PG_PRESENT)) {
         return -EINVAL;
     }
 
-    page = PAGE_TBL(pdidx)[ptidx];
+    if (table_large(pmap, pdidx))
+        table_split(pmap, pdidx);
+
+    uint32_t *pte = &table_get(pmap, pdidx)[ptidx];
 
-    if (page & PG_PRESENT) {
-        page &= ~(PG_WRITE|PG_USER);
+    if (*pte & PG_PRESENT) {
+        uint32_t page = *pte & ~(PG_WRITE|PG_USER);
         page |= (flags & (VM_KW | VM_UW))? PG_WRITE : 0;
         page |= (flags & VM_URWX)? PG_USER : 0;
 
-        PAGE_TBL(pdidx)[ptidx] = page;
+        *pte = page;
+        tlb_gather_add(tlb, pmap, vaddr);
     }
 
     return 0;
 }
 
-static inline void page_unmap(vaddr_t vaddr)
+static inline void page_unmap(struct pmap *pmap, struct tlb_gather *tlb, vaddr_t vaddr)
 {
     if (vaddr & PAGE_MASK)
         return;
@@ -204,31 +370,42 @@ static inline void page_unmap(vaddr_t vaddr)
     size_t pdidx = VDIR(vaddr);
     size_t ptidx = VTBL(vaddr);
 
-    if (PAGE_DIR[pdidx] & PG_PRESENT) {
-        if (PAGE_TBL(pdidx)[ptidx] & PG_PRESENT) {
-            uintptr_t old_page = PAGE_ALIGN(PAGE_TBL(pdidx)[ptidx]);
-            //printk("old_page %p (ref=%d)\n", old_page, mm_page_ref(old_page));
+    if (table_large(pmap, pdidx))
+        table_split(pmap, pdidx);
+
+    if (*pde_get(pmap, pdidx) & PG_PRESENT) {
+        uint32_t *pte = &table_get(pmap, pdidx)[ptidx];
 
-            PAGE_TBL(pdidx)[ptidx] = 0;
+        if (*pte & PG_PRESENT) {
+            *pte = 0;
+
+            if (pdidx < 768)
+                pmap->resident--;
 
             /* Decrement references to table */
-            paddr_t table = PHYSADDR(PAGE_DIR[pdidx]);
-            //printk("mm_page_ref(table) = %d\n", mm_page_ref(table));
+            paddr_t table = PHYSADDR(*pde_get(pmap, pdidx));
 
             mm_page_decref(table);
 
             if (mm_page_ref(table) == 0)
-                table_unmap(pdidx);
+                table_unmap(pmap, pdidx);
 
-            tlb_invalidate_page(vaddr);
+            tlb_gather_add(tlb, pmap, vaddr);
         }
     }
 }
 
-static inline uint32_t __page_get_mapping(vaddr_t vaddr)
+static inline uint32_t __page_get_mapping(struct pmap *pmap, vaddr_t vaddr)
 {
-    if (PAGE_DIR[VDIR(vaddr)] & PG_PRESENT) {
-        uint32_t page = PAGE_TBL(VDIR(vaddr))[VTBL(vaddr)];
+    uint32_t pde = *pde_get(pmap, VDIR(vaddr));
+
+    if ((pde & (PG_PRESENT|PG_LARGE)) == (PG_PRESENT|PG_LARGE)) {
+        /* the 4K page inside the large page */
+        return ((pde & ~TABLE_MASK) + (VTBL(vaddr) << 12)) | (pde & (PG_PRESENT|PG_WRITE|PG_USER));
+    }
+
+    if (pde & PG_PRESENT) {
+        uint32_t page = table_get(pmap, VDIR(vaddr))[VTBL(vaddr)];
 
         if (page & PG_PRESENT)
             return page;
@@ -264,8 +441,9 @@ struct pmap *pmap_switch(struct pmap *pmap)
 
     struct pmap *ret = cur_pmap;
 
+    /* threads of the same process share the address space, keep the TLB */
     if (cur_pmap && cur_pmap->map == pmap->map) {
-        cur_pmap == pmap;
+        cur_pmap = pmap;
         return ret;
     }
 
@@ -285,6 +463,7 @@ static struct pmap k_pmap;
 static void setup_i386_paging(void)
 {
     printk("x86: setting up 32-bit paging\n");
+    page_ops_setup();
     uintptr_t __cur_pd = read_cr3() & ~PAGE_MASK;
 
     bootstrap_processor_table = (uint32_t *) VMA(__cur_pd);
@@ -295,6 +474,36 @@ static void setup_i386_paging(void)
     for (int i = 0; bootstrap_processor_table[i]; ++i)
         bootstrap_processor_table[i] = 0;
 
+    uint32_t features = x86_cpuid_features_edx();
+
+    if (features & CPUID_EDX_PGE) {
+        /* the kernel half is the same in every address space, keep it
+         * in the TLB when switching between them */
+        write_cr4(read_cr4() | CR4_PGE);
+        pg_global = PG_GLOBAL;
+    }
+
+    if (features & CPUID_EDX_PSE) {
+        write_cr4(read_cr4() | CR4_PSE);
+        pse = 1;
+
+        /* replace the boot page tables of the kernel mapping with 4 MiB pages */
+        extern char scratch[1024 * 1024];
+        paddr_t boot_tables = (paddr_t) scratch;
+
+        for (int i = 768; i < 1022; ++i) {
+            paddr_t table = PHYSADDR(bootstrap_processor_table[i]);
+
+            if (!(bootstrap_processor_table[i] & PG_PRESENT) ||
+                    table < boot_tables || table >= boot_tables + sizeof(scratch))
+                continue;
+
+            bootstrap_processor_table[i] = (i - 768) * TABLE_SIZE | PG_LARGE | PG_WRITE | PG_PRESENT | pg_global;
+        }
+
+        printk("x86: kernel mapped with 4 MiB pages\n");
+    }
+
     tlb_flush();
 
     k_pmap.map = __cur_pd;
@@ -310,7 +519,11 @@ int arch_page_unmap(vaddr_t vaddr)
     if (vaddr & PAGE_MASK)
         return -EINVAL;
 
-    page_unmap(vaddr);
+    struct tlb_gather tlb = TLB_GATHER_INIT;
+
+    page_unmap(cur_pmap, &tlb, vaddr);
+    tlb_gather_flush(&tlb);
+
     return 0;
 }
 
@@ -383,39 +596,136 @@ void pmap_decref(struct pmap *pmap)
     }
 }
 
-int pmap_add(struct pmap *pmap, vaddr_t va, paddr_t pa, uint32_t flags)
+/**
+ * \ingroup mm
+ * \brief size of large pages, 0 if not supported
+ */
+size_t pmap_large_size(void)
 {
-    //printk("pmap_add(pmap=%p, va=%p, pa=%p, flags=0x%x)\n", pmap, va, pa, flags);
+    return pse? TABLE_SIZE : 0;
+}
+
+/**
+ * \ingroup mm
+ * \brief map `size` bytes at `va` to `pa` with a single page
+ *
+ * \param size either `PAGE_SIZE` or `pmap_large_size()`
+ * \return 0 on success, -ENOTSUP if a page that large can't be mapped
+ * there or -EEXIST if part of the range is already mapped
+ */
+int pmap_add(struct pmap *pmap, vaddr_t va, paddr_t pa, size_t size, uint32_t flags)
+{
+    //printk("pmap_add(pmap=%p, va=%p, pa=%p, size=%d, flags=0x%x)\n", pmap, va, pa, size, flags);
 
     if ((va & PAGE_MASK) || (pa & PAGE_MASK))
         return -EINVAL;
 
-    struct pmap *old_map = pmap_switch(pmap);
+    if (size != PAGE_SIZE && (size != pmap_large_size() || (va & TABLE_MASK) || (pa & TABLE_MASK)))
+        return -ENOTSUP;
+
+    if (size == PAGE_SIZE) {
+        struct tlb_gather tlb = TLB_GATHER_INIT;
 
-    size_t pdidx = VDIR(va);
-    size_t ptidx = VTBL(va);
+        int err = page_map(pmap, &tlb, pa, va, flags);
+        tlb_gather_flush(&tlb);
 
-    page_map(pa, pdidx, ptidx, flags);
-    tlb_invalidate_page(va);
+        return err;
+    }
 
-    pmap_switch(old_map);
+    uint32_t *pde = pde_get(pmap, VDIR(va));
+
+    if (*pde & PG_PRESENT)
+        return -EEXIST;
+
+    uint32_t large = pa | PG_LARGE | PG_PRESENT;
+    large |= flags & (VM_KW | VM_UW)? PG_WRITE : 0;
+    large |= flags & (VM_URWX)? PG_USER : 0;
+    large |= VDIR(va) >= 768? pg_global : 0;
+
+    *pde = large;
+    pmap_invalidate(pmap, va);
+
+    if (VDIR(va) < 768)
+        pmap->resident += TABLE_SIZE / PAGE_SIZE;
 
     return 0;
 }
 
+/**
+ * \ingroup mm
+ * \brief map `nr` consecutive pages starting at `va` to the physical
+ * pages in `pa` in one go
+ */
+int pmap_enter_range(struct pmap *pmap, vaddr_t va, paddr_t *pa, size_t nr, uint32_t flags)
+{
+    if (va & PAGE_MASK)
+        return -EINVAL;
+
+    int err = 0;
+    struct tlb_gather tlb = TLB_GATHER_INIT;
+
+    for (size_t i = 0; i < nr; ++i, va += PAGE_SIZE) {
+        if (pa[i] & PAGE_MASK) {
+            err = -EINVAL;
+            break;
+        }
+
+        page_map(pmap, &tlb, pa[i], va, flags);
+    }
+
+    tlb_gather_flush(&tlb);
+
+    return err;
+}
+
+/**
+ * \ingroup mm
+ * \brief number of large pages mapping the range `sva` to `eva`
+ */
+size_t pmap_large_count(struct pmap *pmap, vaddr_t sva, vaddr_t eva)
+{
+    if (!pse)
+        return 0;
+
+    size_t cnt = 0;
+
+    for (vaddr_t va = sva & ~TABLE_MASK; va < eva; va += TABLE_SIZE) {
+        cnt += table_large(pmap, VDIR(va));
+
+        if (va + TABLE_SIZE < va)
+            break;
+    }
+
+    return cnt;
+}
+
 void pmap_remove(struct pmap *pmap, vaddr_t sva, vaddr_t eva)
 {
     if ((sva & PAGE_MASK) || (eva & PAGE_MASK))
         return;
 
-    struct pmap *old_map = pmap_switch(pmap);
+    struct tlb_gather tlb = TLB_GATHER_INIT;
 
     while (sva < eva) {
-        page_unmap(sva);
+        size_t pdidx = VDIR(sva);
+
+        if (table_large(pmap, pdidx) && !(sva & TABLE_MASK) && eva - sva >= TABLE_SIZE) {
+            /* whole large page */
+            *pde_get(pmap, pdidx) = 0;
+            tlb_gather_add(&tlb, pmap, sva);
+
+            if (pdidx < 768)
+                pmap->resident -= TABLE_SIZE / PAGE_SIZE;
+
+            sva += TABLE_SIZE;
+            continue;
+        }
+
+        page_unmap(pmap, &tlb, sva);
         sva += PAGE_SIZE;
     }
 
-    pmap_switch(old_map);
+    tlb_gather_flush(&tlb);
 }
 
 static void table_remove_all(paddr_t table)
@@ -441,31 +751,50 @@ void pmap_remove_all(struct pmap *pmap)
 {
     //printk("pmap_remove_all(pmap=%p)\n", pmap);
 
-    struct pmap *old_map = pmap_switch(&k_pmap);
+    for (int i = 0; i < 768; ++i) {
+        uint32_t *pde = pde_get(pmap, i);
 
-    paddr_t base = pmap->map;
+        if ((*pde & (PG_PRESENT|PG_LARGE)) == (PG_PRESENT|PG_LARGE)) {
+            paddr_t base = *pde & ~TABLE_MASK;
 
-    uintptr_t old_mount = frame_mount(base);
-    uint32_t *tbl = (uint32_t *) MOUNT_ADDR;
+            for (size_t off = 0; off < TABLE_SIZE; off += PAGE_SIZE)
+                mm_page_decref(base + off);
 
-    for (int i = 0; i < 768; ++i) {
-        if (tbl[i] & PG_PRESENT) {
-            paddr_t table = PHYSADDR(tbl[i]);
+            *pde = 0;
+            continue;
+        }
+
+        if (*pde & PG_PRESENT) {
+            paddr_t table = PHYSADDR(*pde);
             table_remove_all(table);
-            tbl[i] = 0;
+            *pde_get(pmap, i) = 0;
             table_dealloc(table);
         }
     }
 
-    tlb_flush();
-
-    frame_mount(old_mount);
-
-    pmap_switch(old_map);
+    pmap->resident = 0;
+    pmap->tables = 0;
 
+    if (pmap_live(pmap, 0))
+        tlb_flush();
+}
 
+/**
+ * \ingroup mm
+ * \brief number of user pages mapped in `pmap`
+ */
+size_t pmap_resident_count(struct pmap *pmap)
+{
+    return pmap->resident;
+}
 
-    return;
+/**
+ * \ingroup mm
+ * \brief number of page tables allocated for the user part of `pmap`
+ */
+size_t pmap_table_count(struct pmap *pmap)
+{
+    return pmap->tables;
 }
 
 void pmap_protect(struct pmap *pmap, vaddr_t sva, vaddr_t eva, uint32_t prot)
@@ -473,19 +802,29 @@ void pmap_protect(struct pmap *pmap, vaddr_t sva, vaddr_t eva, uint32_t prot)
     if (sva & PAGE_MASK)
         return;
 
-    struct pmap *old_map = pmap_switch(pmap);
+    struct tlb_gather tlb = TLB_GATHER_INIT;
 
     while (sva < eva) {
         size_t pdidx = VDIR(sva);
-        size_t ptidx = VTBL(sva);
 
-        page_protect(pdidx, ptidx, prot);
-        tlb_invalidate_page(sva);
+        if (table_large(pmap, pdidx) && !(sva & TABLE_MASK) && eva - sva >= TABLE_SIZE) {
+            /* whole large page */
+            uint32_t *pde = pde_get(pmap, pdidx);
+            uint32_t large = *pde & ~(PG_WRITE|PG_USER);
+            large |= (prot & (VM_KW | VM_UW))? PG_WRITE : 0;
+            large |= (prot & VM_URWX)? PG_USER : 0;
+
+            *pde = large;
+            tlb_gather_add(&tlb, pmap, sva);
+            sva += TABLE_SIZE;
+            continue;
+        }
 
+        page_protect(pmap, &tlb, sva, prot);
         sva += PAGE_SIZE;
     }
 
-    pmap_switch(old_map);
+    tlb_gather_flush(&tlb);
 }
 
 void pmap_copy(struct pmap *dst_map, struct pmap *src_map, vaddr_t dst_addr, size_t len,
@@ -499,12 +838,19 @@ void pmap_update(struct pmap *pmap)
     return;
 }
 
-static char __copy_buf[PAGE_SIZE] __aligned(PAGE_SIZE);
 void pmap_page_copy(paddr_t src, paddr_t dst)
 {
-    copy_physical_to_virtual(__copy_buf, (char *) src, PAGE_SIZE);
-    copy_virtual_to_physical((char *) dst, __copy_buf, PAGE_SIZE);
-    return;
+    window_map(SRC_WINDOW, src);
+    window_map(DST_WINDOW, dst);
+
+    page_copy(DST_WINDOW, SRC_WINDOW);
+}
+
+void pmap_page_zero(paddr_t paddr)
+{
+    window_map(DST_WINDOW, paddr);
+
+    page_zero(DST_WINDOW);
 }
 
 void pmap_page_protect(struct vm_page *pg, uint32_t flags)
@@ -534,20 +880,10 @@ int pmap_is_referenced(struct vm_page *pg)
 
 paddr_t arch_page_get_mapping(struct pmap *pmap, vaddr_t vaddr)
 {
-    struct pmap *old_map = pmap_switch(pmap);
-
     //printk("arch_page_get_mapping(vaddr=%p)\n", vaddr);
-    uint32_t page = __page_get_mapping(vaddr);
+    uint32_t page = __page_get_mapping(pmap, vaddr);
 
-    if (page) {
-        pmap_switch(old_map);
-
-        return PHYSADDR(page);
-    }
-
-    pmap_switch(old_map);
-
-    return 0;
+    return page? PHYSADDR(page) : 0;
 }
 
 int pmap_page_read(paddr_t paddr, off_t off, size_t size, void *buf)
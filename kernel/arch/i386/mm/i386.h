@@ -6,10 +6,17 @@
 #define PG_PRESENT  1
 #define PG_WRITE    2
 #define PG_USER     4
+#define PG_LARGE    0x80    /* 4 MiB page (directory entries only) */
+#define PG_GLOBAL   0x100   /* kept in the TLB across CR3 reloads */
 
 #define VTBL(n) (((n) >> 12) & 0x3ff)
 #define VDIR(n) (((n) >> 22) & 0x3ff)
 
 #define PHYSADDR(s) ((s) & ~0xfff)
 
+/* page.c */
+extern void (*page_copy)(void *dst, const void *src);
+extern void (*page_zero)(void *dst);
+void page_ops_setup(void);
+
 #endif /* ! _PAGING_I386_H */
@@ -20,8 +20,47 @@
 
 #include <mm/pmap.h>
 #include <mm/mm.h>
+#include <mm/vm.h>
+
+#include "i386.h"
+
+#define TABLE_SPAN  (PAGE_SIZE * 1024)
+
+/* page tables backing the page descriptors window, enough for 4 GiB */
+#define VM_PAGES_TABLES \
+    (((1ULL << 32) / PAGE_SIZE * sizeof(struct vm_page) + TABLE_SPAN - 1) / TABLE_SPAN)
+
+static uint32_t vm_pages_tables[VM_PAGES_TABLES][1024] __aligned(PAGE_SIZE);
 
 void arch_mm_setup(void)
 {
     pmap_init();
 }
+
+/**
+ * map the page descriptors array into its kernel window
+ *
+ * This runs before any allocator is available, so the window is backed
+ * by static page tables hooked directly into the boot page directory.
+ */
+void *arch_mm_pages_map(paddr_t paddr, size_t size)
+{
+    if (size > ARCH_VM_PAGES_SIZE || size > VM_PAGES_TABLES * TABLE_SPAN)
+        panic("page descriptors do not fit in their window");
+
+    uint32_t *pd = (uint32_t *) VMA(read_cr3() & ~PAGE_MASK);
+
+    for (size_t off = 0; off < size; off += PAGE_SIZE) {
+        vaddr_t vaddr = ARCH_VM_PAGES_BASE + off;
+        uint32_t *table = vm_pages_tables[off / TABLE_SPAN];
+
+        if (!(pd[VDIR(vaddr)] & PG_PRESENT))
+            pd[VDIR(vaddr)] = LMA((uintptr_t) table) | PG_WRITE | PG_PRESENT;
+
+        table[VTBL(vaddr)] = (paddr + off) | PG_WRITE | PG_PRESENT;
+    }
+
+    tlb_flush();
+
+    return (void *) ARCH_VM_PAGES_BASE;
+}
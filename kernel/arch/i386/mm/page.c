@@ -0,0 +1,92 @@
+/**********************************************************************
+ *                  Page copy and zero routines
+ *
+ *
+ *  This file is part of AquilaOS and is released under the terms of
+ *  GNU GPLv3 - See LICENSE.
+ *
+ *  Copyright (C) Mohamed Anwar
+ */
+
+#include <core/system.h>
+#include <core/printk.h>
+#include <cpu/cpu.h>
+
+#include "i386.h"
+
+/*
+ * String instructions, available everywhere.
+ */
+static void page_copy_rep(void *dst, const void *src)
+{
+    int d0, d1, d2;
+
+    asm volatile("rep movsl"
+            : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+            : "0"(PAGE_SIZE / 4), "1"(dst), "2"(src)
+            : "memory");
+}
+
+static void page_zero_rep(void *dst)
+{
+    int d0, d1;
+
+    asm volatile("rep stosl"
+            : "=&c"(d0), "=&D"(d1)
+            : "a"(0), "0"(PAGE_SIZE / 4), "1"(dst)
+            : "memory");
+}
+
+/*
+ * SSE2 non-temporal stores. `movnti` only uses general purpose
+ * registers, so there is no FPU/SSE context to save, and the written
+ * page does not evict the working set from the caches.
+ */
+static void page_copy_nt(void *dst, const void *src)
+{
+    uint32_t *d = (uint32_t *) dst;
+    const uint32_t *s = (const uint32_t *) src;
+
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i += 4) {
+        uint32_t a = s[i], b = s[i + 1], c = s[i + 2], e = s[i + 3];
+
+        asm volatile("movnti %1, %0" : "=m"(d[i])     : "r"(a));
+        asm volatile("movnti %1, %0" : "=m"(d[i + 1]) : "r"(b));
+        asm volatile("movnti %1, %0" : "=m"(d[i + 2]) : "r"(c));
+        asm volatile("movnti %1, %0" : "=m"(d[i + 3]) : "r"(e));
+    }
+
+    /* make the stores visible before the page is mapped */
+    asm volatile("sfence":::"memory");
+}
+
+static void page_zero_nt(void *dst)
+{
+    uint32_t *d = (uint32_t *) dst;
+    uint32_t zero = 0;
+
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i += 4) {
+        asm volatile("movnti %1, %0" : "=m"(d[i])     : "r"(zero));
+        asm volatile("movnti %1, %0" : "=m"(d[i + 1]) : "r"(zero));
+        asm volatile("movnti %1, %0" : "=m"(d[i + 2]) : "r"(zero));
+        asm volatile("movnti %1, %0" : "=m"(d[i + 3]) : "r"(zero));
+    }
+
+    asm volatile("sfence":::"memory");
+}
+
+void (*page_copy)(void *dst, const void *src) = page_copy_rep;
+void (*page_zero)(void *dst) = page_zero_rep;
+
+/**
+ * \ingroup mm
+ * \brief select the page copy and zero routines for this CPU
+ */
+void page_ops_setup(void)
+{
+    if (x86_cpuid_features_edx() & CPUID_EDX_SSE2) {
+        page_copy = page_copy_nt;
+        page_zero = page_zero_nt;
+        printk("x86: using non-temporal page copy/zero\n");
+    }
+}
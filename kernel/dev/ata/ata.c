@@ -12,6 +12,7 @@
 #include <fs/devfs.h>
 #include <fs/posix.h>
 #include <fs/mbr.h>
+#include <fs/ioctl.h>
 #include <bits/errno.h>
 
 #include <dev/pci.h>
@@ -92,6 +93,34 @@ static ssize_t ata_write(struct devid *dd, off_t offset, size_t size, void *buf)
     return drive->write(drive, offset, size, buf);
 }
 
+static int ata_ioctl(struct devid *dd, int request, void *argp)
+{
+    size_t drive_id  = dd->minor / 64;
+    size_t partition = dd->minor % 64;
+
+    struct ata_drive *drive = &drives[drive_id];
+
+    switch (request) {
+        case BLKGETSIZE:
+            if (!partition) {
+                *(unsigned long *) argp = drive->max_lba;
+            } else {
+                if (partition > 4)
+                    return -EINVAL;
+
+                /* read the partition table */
+                drive->read(drive, 0, 1, read_buf);
+
+                struct mbr *mbr = (struct mbr *) read_buf;
+                *(unsigned long *) argp = mbr->ptab[partition-1].sectors_count;
+            }
+
+            return 0;
+    }
+
+    return -EINVAL;
+}
+
 static uint8_t ata_detect_drive(struct ata_drive *drive)
 {
     if (!drive->slave) {
@@ -312,6 +341,7 @@ struct dev atadev = {
     .probe = ata_probe,
     .read  = ata_read,
     .write = ata_write,
+    .ioctl = ata_ioctl,
     .getbs = ata_getbs,
 
     .fops = {
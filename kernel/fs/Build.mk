@@ -19,6 +19,7 @@ obj-y  += vfs.o
 dirs-y += pseudofs/
 dirs-y += initramfs/
 dirs-y += posix/
+dirs-y += shmfs/
 obj-y  += pipe.o
 obj-y  += rofs.o
 obj-y  += vcache.o
@@ -13,14 +13,16 @@ struct cache_block {
     void *data;
 
     int dirty;
+
+    struct hashmap_node node;
 };
 
-static int bcache_eq(void *_a, void *_b)
+static int bcache_eq(struct hashmap_node *node, void *_off)
 {
-    struct cache_block *a = (struct cache_block *) _a;
-    off_t *b = (off_t *) _b;
+    struct cache_block *block = hashmap_entry(node, struct cache_block, node);
+    uint64_t *off = (uint64_t *) _off;
 
-    return a->off == *b;
+    return block->off == (off_t) *off;
 }
 
 void bcache_init(struct bcache *bcache)
@@ -43,7 +45,7 @@ int bcache_insert(struct bcache *bcache, uint64_t off, void *data)
     block->data = data;
 
     hash_t hash = hashmap_digest(&off, sizeof(off));
-    return hashmap_insert(bcache->hashmap, hash, block);
+    return hashmap_insert(bcache->hashmap, hash, &block->node);
 }
 
 int bcache_remove(struct bcache *bcache, uint64_t off)
@@ -56,10 +58,8 @@ int bcache_remove(struct bcache *bcache, uint64_t off)
     struct hashmap_node *node = hashmap_lookup(bcache->hashmap, hash, &off);
 
     if (node) {
-        void *block = node->entry;
-        node->entry = NULL;
-        kfree(node->entry);
         hashmap_node_remove(bcache->hashmap, node);
+        kfree(hashmap_entry(node, struct cache_block, node));
         return 0;
     }
 
@@ -76,7 +76,7 @@ void *bcache_find(struct bcache *bcache, uint64_t off)
     struct hashmap_node *node = hashmap_lookup(bcache->hashmap, hash, &off);
 
     if (node) {
-        struct cache_block *block = (struct cache_block *) node->entry;
+        struct cache_block *block = hashmap_entry(node, struct cache_block, node);
         return block->data;
     }
 
@@ -93,7 +93,7 @@ void bcache_dirty(struct bcache *bcache, uint64_t off)
     struct hashmap_node *node = hashmap_lookup(bcache->hashmap, hash, &off);
 
     if (node) {
-        struct cache_block *block = (struct cache_block *) node->entry;
+        struct cache_block *block = hashmap_entry(node, struct cache_block, node);
         block->dirty = 1;
     }
 }
@@ -14,6 +14,7 @@
 #include <sys/proc.h>
 #include <sys/sched.h>
 
+#include <mm/pmap.h>
 #include <mm/vm.h>
 #include <mm/buddy.h>
 #include <ds/buddy.h>
@@ -34,16 +35,38 @@ static ssize_t procfs_meminfo(off_t off, size_t size, char *buf)
 {
     char meminfo_buf[512];
     extern size_t k_total_mem, k_used_mem, kvmem_used, kvmem_obj_cnt;
+    extern size_t kvmem_cached_pages, kvmem_reclaimed_pages;
+    extern size_t mm_zero_pool_cnt, mm_zero_hits, mm_zero_misses;
+    extern size_t vm_cache_pages, vm_cache_evicted;
+    extern size_t swap_slots_nr, swap_slots_used;
 
     int sz = snprintf(meminfo_buf, 512, 
             "MemTotal: %d kB\n"
             "MemFree: %d kB\n"
             "KVMemUsed: %d KB\n"
-            "KVMemObjCnt: %d\n",
+            "KVMemObjCnt: %d\n"
+            "KVMemCached: %d kB\n"
+            "KVMemReclaimed: %d kB\n"
+            "ZeroPool: %d kB\n"
+            "ZeroPoolHits: %d\n"
+            "ZeroPoolMisses: %d\n"
+            "Cached: %d kB\n"
+            "CacheEvicted: %d kB\n"
+            "SwapTotal: %d kB\n"
+            "SwapFree: %d kB\n",
             k_total_mem/1024,
             (k_total_mem-k_used_mem)/1024,
             kvmem_used/1024,
-            kvmem_obj_cnt
+            kvmem_obj_cnt,
+            kvmem_cached_pages * PAGE_SIZE/1024,
+            kvmem_reclaimed_pages * PAGE_SIZE/1024,
+            mm_zero_pool_cnt * PAGE_SIZE/1024,
+            mm_zero_hits,
+            mm_zero_misses,
+            vm_cache_pages * PAGE_SIZE/1024,
+            vm_cache_evicted * PAGE_SIZE/1024,
+            swap_slots_nr * PAGE_SIZE/1024,
+            (swap_slots_nr - swap_slots_used) * PAGE_SIZE/1024
             );
 
     if (off < sz) {
@@ -61,8 +84,9 @@ static ssize_t procfs_kvmem(off_t off, size_t size, char *buf)
     //printk("procfs_kvmem(off=%d, size=%d, buf=%p)\n", off, size, buf);
 
     extern struct queue *malloc_types;
+    extern size_t kvmem_slab_pages;
 
-    char kvmem_buf[1024];
+    char kvmem_buf[2048];
     int sz = 0;
 
     queue_for (node, malloc_types) {
@@ -74,6 +98,28 @@ static ssize_t procfs_kvmem(off_t off, size_t size, char *buf)
             break;
     }
 
+    /* object caches: name, object size, objects in use, capacity, slabs */
+    if ((size_t) sz < sizeof(kvmem_buf))
+        sz += snprintf(kvmem_buf + sz, sizeof(kvmem_buf) - sz,
+                "\nslabs %d\n", kvmem_slab_pages) - 1;
+
+    queue_for (node, malloc_types) {
+        struct malloc_type *type = (struct malloc_type *) node->value;
+        struct kvmem_cache *cache = type->cache;
+
+        if ((size_t) sz >= sizeof(kvmem_buf))
+            break;
+
+        if (!cache)
+            continue;
+
+        sz += snprintf(kvmem_buf + sz, sizeof(kvmem_buf) - sz,
+                "%s %d %d %d %d\n", type->name, cache->size, cache->inuse,
+                cache->slabs_nr * cache->nr, cache->slabs_nr) - 1;
+    }
+
+    sz = MIN((size_t) sz, sizeof(kvmem_buf));
+
     if (off < sz) {
         ssize_t ret = MIN(size, (size_t)(sz - off));
         memcpy(buf, kvmem_buf + off, ret);
@@ -303,9 +349,47 @@ static ssize_t procfs_proc_status(int pid, off_t off, size_t size, void *buf)
     if (!proc)
         return -ENONET;
 
-    char status_buf[512];
+    /* private pages still shared with the page cache, pages in swap */
+    size_t cow_shared = 0, swapped = 0;
+
+    /* resident pages by kind */
+    size_t rss_anon = 0, rss_file = 0, rss_shared = 0;
 
-    int sz = snprintf(status_buf, 512,
+    struct pmap *pmap = proc->vm_space.pmap;
+
+    vm_space_for (vm_entry, &proc->vm_space) {
+        for (vaddr_t va = vm_entry->base; va < vm_entry->base + vm_entry->size; va += PAGE_SIZE) {
+            paddr_t paddr = arch_page_get_mapping(pmap, va);
+            struct vm_page *vm_page = paddr? mm_page(paddr) : NULL;
+
+            if (!vm_page || vm_page == mm_zero_page)
+                continue;
+
+            if (!vm_page->vm_object)
+                rss_anon++;
+            else if (vm_page->vm_object->type == VMOBJ_FILE)
+                rss_file++;
+            else
+                rss_shared++;
+        }
+
+        struct vm_aref *vm_aref;
+
+        if (!vm_entry->vm_anon)
+            continue;
+
+        radix_tree_for (vm_aref, idx, &vm_entry->vm_anon->arefs) {
+            if ((vm_aref->flags & VM_COPY) && vm_aref->vm_page != mm_zero_page)
+                cow_shared++;
+
+            if (vm_aref->swap)
+                swapped++;
+        }
+    }
+
+    char status_buf[1024];
+
+    int sz = snprintf(status_buf, sizeof(status_buf),
             "name: %s\n"
             "pid: %d\n"
             "ppid: %d\n"
@@ -314,7 +398,15 @@ static ssize_t procfs_proc_status(int pid, off_t off, size_t size, void *buf)
             "uid: %d\n"
             "gid: %d\n"
             "heap: 0x%x\n"
-            "threads_nr: %d\n",
+            "threads_nr: %d\n"
+            "cow_shared: %d kB\n"
+            "rss: %d kB\n"
+            "rss_anon: %d kB\n"
+            "rss_file: %d kB\n"
+            "rss_shared: %d kB\n"
+            "swap: %d kB\n"
+            "page_tables: %d kB\n"
+            "kernel_stacks: %d kB\n",
             proc->name,
             proc->pid,
             proc->parent ? proc->parent->pid : 0,
@@ -323,7 +415,15 @@ static ssize_t procfs_proc_status(int pid, off_t off, size_t size, void *buf)
             proc->uid,
             proc->gid,
             proc->heap,
-            proc->threads.count
+            proc->threads.count,
+            cow_shared * PAGE_SIZE / 1024,
+            pmap_resident_count(pmap) * PAGE_SIZE / 1024,
+            rss_anon * PAGE_SIZE / 1024,
+            rss_file * PAGE_SIZE / 1024,
+            rss_shared * PAGE_SIZE / 1024,
+            swapped * PAGE_SIZE / 1024,
+            pmap_table_count(pmap) * PAGE_SIZE / 1024,
+            proc->threads.count * KERN_STACK_SIZE / 1024
             );
 
     if (off < sz) {
@@ -346,9 +446,7 @@ static ssize_t procfs_proc_maps(int pid, off_t off, size_t size, void *buf)
 
     int sz = 0;
 
-    struct queue *vm_entries = &proc->vm_space.vm_entries;
-    queue_for (node, vm_entries) {
-        struct vm_entry *vm_entry = node->value;
+    vm_space_for (vm_entry, &proc->vm_space) {
 
         char perm[5] = {0};
         perm[0] = vm_entry->flags & VM_UR? 'r' : '-';
@@ -369,15 +467,20 @@ static ssize_t procfs_proc_maps(int pid, off_t off, size_t size, void *buf)
         if (vm_entry->vm_object && vm_entry->vm_object->type == VMOBJ_FILE)
             vnode = (struct vnode *) vm_entry->vm_object->p;
 
+        /* regions (partly) backed by large pages */
+        size_t huge = pmap_large_count(proc->vm_space.pmap, vm_entry->base,
+                vm_entry->base + vm_entry->size);
+
         sz += snprintf(maps_buf + sz, sizeof(maps_buf) - sz,
-                "%x-%x %s %x %x %x %s\n",
+                "%x-%x %s %x %x %x %s%s\n",
                 vm_entry->base,  /* Start address */
                 vm_entry->base + vm_entry->size,  /* End address */
                 perm,   /* Access permissions */
                 vm_entry->off, /* Offset in file */
                 vnode? vnode->dev : 0, /* Device ID */
                 vnode? vnode->ino : 0, /* Inode ID */
-                desc); 
+                desc,
+                huge? " [huge]" : ""); 
     }
     
     if (off < sz) {
@@ -400,10 +503,7 @@ static ssize_t procfs_proc_vmstats(int pid, off_t off, size_t size, void *buf)
 
     int sz = 0;
 
-    struct queue *vm_entries = &proc->vm_space.vm_entries;
-
-    queue_for (node, vm_entries) {
-        struct vm_entry *vm_entry = node->value;
+    vm_space_for (vm_entry, &proc->vm_space) {
 
         char perm[5] = {0};
         perm[0] = vm_entry->flags & VM_UR? 'r' : '-';
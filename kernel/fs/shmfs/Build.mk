@@ -0,0 +1 @@
+obj-y += shmfs.o
@@ -0,0 +1,332 @@
+/**
+ * \defgroup fs-shmfs kernel/fs/shmfs
+ * \brief shared memory filesystem (shmfs) handler
+ *
+ * Files live in the pages of a zero fill `vm_object` instead of a heap
+ * buffer, so every `mmap(MAP_SHARED)` of a file maps the very same
+ * physical pages and read/write go through them as well. This backs
+ * `shm_open` and `shm_unlink`, names are looked up in `shmfs_root`
+ * (usually mounted on /dev/shm).
+ */
+
+#include <core/system.h>
+#include <core/module.h>
+#include <core/string.h>
+#include <core/time.h>
+
+#include <mm/mm.h>
+#include <mm/vm.h>
+
+#include <fs/vfs.h>
+#include <fs/pseudofs.h>
+#include <fs/shmfs.h>
+#include <fs/posix.h>
+
+#include <bits/errno.h>
+#include <bits/fcntl.h>
+
+/* shmfs root directory */
+struct vnode *shmfs_root = NULL;
+
+/* window used to access object pages from the kernel */
+static char __shm_io[PAGE_SIZE] __aligned(PAGE_SIZE);
+
+static int shmfs_vget(struct vnode *super, ino_t ino, struct vnode **vnode)
+{
+    /* vnode is always present in memory */
+    struct vnode *node = (struct vnode *) ino;
+    if (vnode) *vnode = node;
+
+    return 0;
+}
+
+static int shmfs_vmknod(struct vnode *dir, const char *fn, mode_t mode, dev_t dev, struct uio *uio, struct vnode **ref)
+{
+    /* flat namespace of regular files */
+    if (!S_ISREG(mode))
+        return -EINVAL;
+
+    struct vnode *vnode = NULL;
+    int err = pseudofs_vmknod(dir, fn, mode, dev, uio, &vnode);
+
+    if (err)
+        return err;
+
+    struct vm_object *vm_object = vm_object_zero();
+
+    if (!vm_object) {
+        pseudofs_vunlink(dir, fn, uio);
+        return -ENOMEM;
+    }
+
+    vm_object->type = VMOBJ_SHM;
+    vm_object->p = vnode;
+    vnode->vm_object = vm_object;
+
+    if (ref) *ref = vnode;
+
+    return 0;
+}
+
+static int shmfs_close(struct vnode *vnode)
+{
+    /* Inode is always present in memory */
+
+    if (!vnode->ref && !vnode->nlink) {
+        /* pages stay around while still mapped */
+        if (vnode->vm_object) {
+            vnode->vm_object->p = NULL;
+            vm_object_decref(vnode->vm_object);
+        }
+
+        pseudofs_close(vnode);
+    }
+
+    return 0;
+}
+
+static ssize_t shmfs_read(struct vnode *vnode, off_t offset, size_t size, void *buf)
+{
+    if ((size_t) offset >= vnode->size)
+        return 0;
+
+    size = MIN(size, vnode->size - offset);
+
+    size_t done = 0;
+
+    while (done < size) {
+        size_t off = offset + done;
+        size_t len = MIN(size - done, PAGE_SIZE - (off & PAGE_MASK));
+
+        struct vm_page *vm_page = vm_object_page_get(vnode->vm_object, off);
+
+        if (vm_page) {
+            mm_page_map(kvm_space.pmap, (vaddr_t) __shm_io, vm_page->paddr, VM_KR);
+            memcpy((char *) buf + done, __shm_io + (off & PAGE_MASK), len);
+        } else {
+            /* never written */
+            memset((char *) buf + done, 0, len);
+        }
+
+        done += len;
+    }
+
+    return size;
+}
+
+static ssize_t shmfs_write(struct vnode *vnode, off_t offset, size_t size, void *buf)
+{
+    struct vm_object *vm_object = vnode->vm_object;
+    size_t done = 0;
+
+    while (done < size) {
+        size_t off = offset + done;
+        size_t len = MIN(size - done, PAGE_SIZE - (off & PAGE_MASK));
+
+        struct vm_page *vm_page = vm_object_page_get(vm_object, off);
+
+        if (!vm_page && !(vm_page = vm_object->pager->in(vm_object, off)))
+            break;
+
+        /* can't be written back, keeps it from being evicted */
+        vm_object_page_dirty(vm_page);
+
+        mm_page_map(kvm_space.pmap, (vaddr_t) __shm_io, vm_page->paddr, VM_KW);
+        memcpy(__shm_io + (off & PAGE_MASK), (char *) buf + done, len);
+
+        done += len;
+    }
+
+    if (!done && size)
+        return -ENOMEM;
+
+    if ((size_t) offset + done > vnode->size)
+        vnode->size = offset + done;
+
+    return done;
+}
+
+static int shmfs_trunc(struct vnode *vnode, off_t len)
+{
+    if (!vnode || len < 0)
+        return -EINVAL;
+
+    if ((size_t) len < vnode->size) {
+        /* zero the tail of the last page in case the file grows again */
+        struct vm_page *vm_page = vm_object_page_get(vnode->vm_object, len);
+
+        if (vm_page && (len & PAGE_MASK)) {
+            mm_page_map(kvm_space.pmap, (vaddr_t) __shm_io, vm_page->paddr, VM_KW);
+            memset(__shm_io + (len & PAGE_MASK), 0, PAGE_SIZE - (len & PAGE_MASK));
+        }
+
+        vm_object_truncate(vnode->vm_object, len);
+    }
+
+    vnode->size = len;
+
+    return 0;
+}
+
+/* names are a single component with a leading slash ("/name") */
+static int shmfs_name_valid(const char *name)
+{
+    if (!name || *name != '/' || !name[1])
+        return 0;
+
+    for (const char *c = name + 1; *c; ++c)
+        if (*c == '/')
+            return 0;
+
+    return strlen(name + 1) < (int) sizeof(((struct dirent *) 0)->d_name);
+}
+
+/**
+ * \ingroup fs-shmfs
+ * \brief lookup (and create with O_CREAT) the shared memory object `name`
+ *
+ * `name` is of the form "/name", a reference to the vnode is returned
+ * in `ref`.
+ */
+int shmfs_open(const char *name, int oflags, mode_t mode, struct uio *uio, struct vnode **ref)
+{
+    if (!shmfs_root)
+        return -ENOSYS;
+
+    if (!shmfs_name_valid(name))
+        return -EINVAL;
+
+    struct dirent dirent;
+    int err = vfs_finddir(shmfs_root, name + 1, &dirent);
+
+    if (!err) {
+        if ((oflags & O_CREAT) && (oflags & O_EXCL))
+            return -EEXIST;
+
+        return vfs_vget(shmfs_root, dirent.d_ino, ref);
+    }
+
+    if (err != -ENOENT || !(oflags & O_CREAT))
+        return err;
+
+    return vfs_vmknod(shmfs_root, name + 1, S_IFREG | (mode & 0777), 0, uio, ref);
+}
+
+/**
+ * \ingroup fs-shmfs
+ * \brief remove the shared memory object `name`
+ *
+ * Its pages are released once it is neither open nor mapped anymore.
+ */
+int shmfs_unlink(const char *name, struct uio *uio)
+{
+    if (!shmfs_root)
+        return -ENOSYS;
+
+    if (!shmfs_name_valid(name))
+        return -EINVAL;
+
+    return vfs_vunlink(shmfs_root, name + 1, uio);
+}
+
+/* ================ File Operations ================ */
+
+static int shmfs_file_can_read(struct file *file, size_t size)
+{
+    if ((size_t) file->offset + size < file->vnode->size)
+        return 1;
+
+    return 0;
+}
+
+static int shmfs_file_can_write(struct file *file __unused, size_t size __unused)
+{
+    return 1;
+}
+
+static int shmfs_file_eof(struct file *file)
+{
+    return (size_t) file->offset >= file->vnode->size;
+}
+
+static int shmfs_init()
+{
+    shmfs_root = kmalloc(sizeof(struct vnode), &M_VNODE, M_ZERO);
+    if (!shmfs_root) return -ENOMEM;
+
+    shmfs_root->ino   = (vino_t) shmfs_root;
+    shmfs_root->mode  = S_IFDIR | 01777;
+    shmfs_root->nlink = 2;
+    shmfs_root->fs    = &shmfs;
+    shmfs_root->ref   = 1;
+
+    struct timespec ts;
+    gettime(&ts);
+
+    shmfs_root->ctime = ts;
+    shmfs_root->atime = ts;
+    shmfs_root->mtime = ts;
+
+    int err = vfs_install(&shmfs);
+
+    if (err) {
+        kfree(shmfs_root);
+        shmfs_root = NULL;
+        return err;
+    }
+
+    return 0;
+}
+
+static int shmfs_mount(const char *dir, int flags __unused, void *data __unused)
+{
+    if (!shmfs_root)
+        return -EINVAL;
+
+    return vfs_bind(dir, shmfs_root);
+}
+
+static int shmfs_map(struct vm_space *vm_space __unused, struct vm_entry *vm_entry __unused)
+{
+    /* pages are faulted in from the object */
+    return 0;
+}
+
+struct fs shmfs = {
+    .name   = "shmfs",
+    .nodev  = 1,
+    .init   = shmfs_init,
+    .mount  = shmfs_mount,
+
+    .vops = {
+        .read    = shmfs_read,
+        .write   = shmfs_write,
+        .close   = shmfs_close,
+        .trunc   = shmfs_trunc,
+        .map     = shmfs_map,
+
+        .readdir = pseudofs_readdir,
+        .finddir = pseudofs_finddir,
+
+        .vmknod  = shmfs_vmknod,
+        .vunlink = pseudofs_vunlink,
+        .vget    = shmfs_vget,
+    },
+
+    .fops = {
+        .open    = posix_file_open,
+        .close   = posix_file_close,
+        .read    = posix_file_read,
+        .write   = posix_file_write,
+        .ioctl   = posix_file_ioctl,
+        .lseek   = posix_file_lseek,
+        .readdir = posix_file_readdir,
+        .trunc   = posix_file_trunc,
+
+        .can_read  = shmfs_file_can_read,
+        .can_write = shmfs_file_can_write,
+        .eof       = shmfs_file_eof,
+    },
+};
+
+MODULE_INIT(shmfs, shmfs_init, NULL)
@@ -3,12 +3,12 @@
 
 MALLOC_DEFINE(M_VCACHE, "vcache", "vnode cache structure");
 
-static int vcache_eq(void *_a, void *_b)
+static int vcache_eq(struct hashmap_node *node, void *_ino)
 {
-    struct vnode *a = (struct vnode *) _a;
-    ino_t *b = (ino_t *) _b;
+    struct vnode *vnode = hashmap_entry(node, struct vnode, vcache_node);
+    ino_t *ino = (ino_t *) _ino;
 
-    return a->ino == *b;
+    return vnode->ino == *ino;
 }
 
 /**
@@ -29,7 +29,7 @@ int vcache_insert(struct vcache *vcache, struct vnode *vnode)
         vcache_init(vcache);
 
     hash_t hash = hashmap_digest(&vnode->ino, sizeof(vnode->ino));
-    return hashmap_insert(vcache->hashmap, hash, vnode);
+    return hashmap_insert(vcache->hashmap, hash, &vnode->vcache_node);
 }
 
 int vcache_remove(struct vcache *vcache, struct vnode *vnode)
@@ -59,7 +59,7 @@ struct vnode *vcache_find(struct vcache *vcache, ino_t ino)
     struct hashmap_node *node = hashmap_lookup(vcache->hashmap, hash, &ino);
 
     if (node) {
-        return (struct vnode *) node->entry;
+        return hashmap_entry(node, struct vnode, vcache_node);
     }
 
     return NULL;
@@ -14,7 +14,7 @@
 #include <dev/dev.h>
 #include <net/socket.h>
 
-MALLOC_DEFINE(M_VNODE, "vnode", "vnode structure");
+MALLOC_DEFINE_CACHE(M_VNODE, "vnode", "vnode structure", sizeof(struct vnode), NULL);
 MALLOC_DEFINE(M_VFS_PATH, "vfs-path", "vfs path structure");
 MALLOC_DEFINE(M_VFS_NODE, "vfs-node", "vfs node structure");
 MALLOC_DEFINE(M_FS_LIST, "fs-list", "filesystems list");
@@ -1,16 +1,11 @@
 #include <core/system.h>
+#include <core/arch.h>
+
+#include <mm/pmap.h>
 #include <mm/vm.h>
 
 static struct vm_pager vnode_pager;
 
-static int vm_page_eq(void *_a, void *_b)
-{
-    struct vm_page *a = (struct vm_page *) _a;
-    size_t *b = (size_t *) _b;
-
-    return a->off == *b;
-}
-
 /**
  * \ingroup vfs
  * \brief create a new `vm_object` associated with a `vnode`
@@ -27,13 +22,6 @@ struct vm_object *vm_object_vnode(struct vnode *vnode)
         if (!vm_object) return NULL;
 
         vm_object->type  = VMOBJ_FILE;
-        vm_object->pages = hashmap_new(0, vm_page_eq);
-
-        if (!vm_object->pages) {
-            kfree(vm_object);
-            return NULL;
-        }
-
         vm_object->pager = &vnode_pager;
         vm_object->p = vnode;
 
@@ -44,27 +32,109 @@ struct vm_object *vm_object_vnode(struct vnode *vnode)
 }
 
 
-static char __load[PAGE_SIZE] __aligned(PAGE_SIZE);
+/* read-ahead window bounds, in pages */
+#define VNODE_RA_MIN    4
+#define VNODE_RA_MAX    16
+
+static char __load[VNODE_RA_MAX * PAGE_SIZE] __aligned(PAGE_SIZE);
+
+/*
+ * Pages in the page at `off` together with the uncached pages following
+ * it, up to the read-ahead window, using a single read. The window
+ * doubles while faults on the object are sequential and falls back to
+ * the minimum on a random access.
+ */
 struct vm_page *vnode_page_in(struct vm_object *vm_object, size_t off)
 {
-    struct vm_page *vm_page = mm_page_alloc();
-    if (!vm_page) return NULL;
+    struct vnode *vnode = (struct vnode *) vm_object->p;
+
+    off = PAGE_ALIGN(off);
+
+    if (off == vm_object->ra_next)
+        vm_object->ra_nr = MIN(MAX(vm_object->ra_nr * 2, VNODE_RA_MIN), VNODE_RA_MAX);
+    else
+        vm_object->ra_nr = VNODE_RA_MIN;
+
+    /* contiguous uncached pages inside the file */
+    size_t nr = 1, eof = PAGE_ROUND(vnode->size);
 
-    vm_page->vm_object = vm_object;
-    vm_page->off = PAGE_ALIGN(off);
-    vm_page->ref = 1;
+    while (nr < vm_object->ra_nr && off + nr * PAGE_SIZE < eof &&
+            !vm_object_page_get(vm_object, off + nr * PAGE_SIZE))
+        ++nr;
 
+    struct vm_page *vm_pages[VNODE_RA_MAX];
+    paddr_t paddrs[VNODE_RA_MAX];
+    size_t i;
+
+    for (i = 0; i < nr; ++i) {
+        if (!(vm_pages[i] = mm_page_alloc(0)))
+            break;
+
+        paddrs[i] = vm_pages[i]->paddr;
+    }
+
+    /* only the faulting page is mandatory */
+    if (!(nr = i))
+        return NULL;
+
+    pmap_enter_range(kvm_space.pmap, (vaddr_t) __load, paddrs, nr, VM_KW);
+    ssize_t ret = vfs_read(vnode, off, nr * PAGE_SIZE, (void *) __load);
+
+    if (ret < 0)
+        ret = 0;
+
+    /* don't expose stale memory past the end of file */
+    if ((size_t) ret < nr * PAGE_SIZE)
+        memset(__load + ret, 0, nr * PAGE_SIZE - ret);
+
+    vm_object->ra_next = off + nr * PAGE_SIZE;
+
+    for (i = 0; i < nr; ++i) {
+        struct vm_page *vm_page = vm_pages[i];
+
+        vm_page->vm_object = vm_object;
+        vm_page->off = off + i * PAGE_SIZE;
+        vm_page->ref = 1;
+
+        if (vm_object_page_insert(vm_object, vm_page)) {
+            mm_page_dealloc(vm_page->paddr);
+
+            if (!i)
+                vm_pages[0] = NULL;
+        }
+    }
+
+    return vm_pages[0];
+}
+
+static char __store[PAGE_SIZE] __aligned(PAGE_SIZE);
+int vnode_page_out(struct vm_object *vm_object, size_t off)
+{
+    off = PAGE_ALIGN(off);
+
+    struct vm_page *vm_page = vm_object_page_get(vm_object, off);
+
+    if (!vm_page)
+        return -EINVAL;
     struct vnode *vnode = (struct vnode *) vm_object->p;
 
-    mm_page_map(kvm_space.pmap, (vaddr_t) __load, vm_page->paddr, VM_KW);
-    vfs_read(vnode, vm_page->off, PAGE_SIZE, (void *) __load);
+    if (off < vnode->size) {
+        /* don't extend the file with the tail of the last page */
+        size_t size = MIN(PAGE_SIZE, vnode->size - off);
+
+        mm_page_map(kvm_space.pmap, (vaddr_t) __store, vm_page->paddr, VM_KR);
+        ssize_t ret = vfs_write(vnode, off, size, (void *) __store);
+
+        if (ret < 0)
+            return ret;
+    }
 
-    vm_object_page_insert(vm_object, vm_page);
+    vm_page->flags &= ~VM_PAGE_DIRTY;
 
-    return vm_page;
+    return 0;
 }
 
 static struct vm_pager vnode_pager = {
     .in = vnode_page_in,
-    .out = NULL,
+    .out = vnode_page_out,
 };
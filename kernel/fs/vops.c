@@ -1,4 +1,5 @@
 #include <core/system.h>
+#include <core/panic.h>
 #include <fs/vfs.h>
 
 int vfs_vmknod(struct vnode *dir, const char *name, mode_t mode, dev_t dev, struct uio *uio, struct vnode **ref)
@@ -66,9 +67,37 @@ int vfs_vget(struct vnode *super, ino_t ino, struct vnode **ref)
     return err;
 }
 
+/**
+ * \ingroup vfs
+ * \brief take a reference to `vnode` without opening it
+ */
+void vfs_vhold(struct vnode *vnode)
+{
+    vnode->ref++;
+}
+
+/**
+ * \ingroup vfs
+ * \brief drop a reference taken with `vfs_vhold`
+ *
+ * Unlike `vfs_close`, the reference is dropped even if the filesystem
+ * has no close operation.
+ */
+void vfs_vrele(struct vnode *vnode)
+{
+    if (!vnode->ref)
+        panic("releasing an unreferenced vnode");
+
+    if (!--vnode->ref && vnode->fs && vnode->fs->vops.close)
+        vnode->fs->vops.close(vnode);
+}
+
 int vfs_map(struct vm_space *vm_space, struct vm_entry *vm_entry)
 {
-    if (!vm_entry || !vm_entry->vm_object || vm_entry->vm_object->type != VMOBJ_FILE)
+    if (!vm_entry || !vm_entry->vm_object)
+        return -EINVAL;
+
+    if (vm_entry->vm_object->type != VMOBJ_FILE && vm_entry->vm_object->type != VMOBJ_SHM)
         return -EINVAL;
 
     struct vnode *vnode = (struct vnode *) vm_entry->vm_object->p;
@@ -79,8 +108,10 @@ int vfs_map(struct vm_space *vm_space, struct vm_entry *vm_entry)
     if (ISDEV(vnode))
         return kdev_map(&VNODE_DEV(vnode), vm_space, vm_entry);
 
-    if (!vnode->fs->vops.map)
-        return -ENOSYS;
+    if (!vnode->fs->vops.map) {
+        /* regular files are paged in on demand through the page cache */
+        return S_ISREG(vnode->mode)? 0 : -ENOSYS;
+    }
 
     return vnode->fs->vops.map(vm_space, vm_entry);
 }
@@ -10,5 +10,14 @@
 #define MAP_FIXED   0x00001
 #define MAP_PRIVATE 0x00002
 #define MAP_SHARED  0x00004
+#define MAP_ANONYMOUS   0x00008
+#define MAP_ANON    MAP_ANONYMOUS
+#define MAP_POPULATE    0x00010
+
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef _BITS_RESOURCE_H
+#define _BITS_RESOURCE_H
+
+typedef unsigned long rlim_t;
+
+#define RLIM_INFINITY   ((rlim_t) -1)
+
+struct rlimit {
+    rlim_t rlim_cur;    /* soft limit */
+    rlim_t rlim_max;    /* hard limit */
+};
+
+#define RLIMIT_CPU      0
+#define RLIMIT_FSIZE    1
+#define RLIMIT_DATA     2
+#define RLIMIT_STACK    3
+#define RLIMIT_CORE     4
+#define RLIMIT_RSS      5
+#define RLIMIT_NPROC    6
+#define RLIMIT_NOFILE   7
+#define RLIMIT_MEMLOCK  8
+#define RLIMIT_AS       9
+
+#define RLIMIT_NLIMITS  10
+
+#endif
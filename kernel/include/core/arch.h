@@ -36,6 +36,7 @@ void arch_handle_signal(int sig);
 
 /* arch/ARCH/mm/mm.c */
 void arch_mm_setup(void);
+void *arch_mm_pages_map(paddr_t paddr, size_t size);
 
 paddr_t arch_page_get_mapping(struct pmap *pmap, vaddr_t vaddr);
 
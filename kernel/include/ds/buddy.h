@@ -4,12 +4,15 @@
 #include <core/system.h>
 #include <ds/bitmap.h>
 
+struct vm_page;
+
 /**
  * \ingroup ds
  * \brief buddy structure
  */
 struct buddy {
-    size_t first_free_idx;
+    /** free blocks of this order, linked through their first page */
+    struct vm_page *free_list;
     size_t usable;
     struct bitmap bitmap;
 };
@@ -8,34 +8,46 @@ struct hashmap_node;
 
 #include <core/string.h>
 #include <bits/errno.h>
-#include <ds/queue.h>
 
 typedef uintptr_t hash_t;
 
-#define HASHMAP_DEFAULT 20
+/* initial number of buckets, always a power of two */
+#define HASHMAP_DEFAULT 16
+
+/**
+ * \ingroup ds
+ * \brief hashmap node
+ *
+ * Nodes are embedded inside the elements stored in the hashmap, the
+ * element is recovered with `hashmap_entry`.
+ */
+struct hashmap_node {
+    hash_t hash;
+    struct hashmap_node *next;
+};
 
 /**
  * \ingroup ds
  * \brief hashmap
+ *
+ * Chained hashmap with a power of two number of buckets, doubled
+ * whenever the number of elements exceeds the number of buckets.
  */
 struct hashmap {
     size_t count;
 
     size_t buckets_nr;
-    struct queue *buckets;
+    struct hashmap_node **buckets;
 
-    int (*eq)(void *a, void *b);
+    int (*eq)(struct hashmap_node *node, void *key);
 };
 
 /**
  * \ingroup ds
- * \brief hashmap node
+ * \brief get the element containing a hashmap node
  */
-struct hashmap_node {
-    hash_t hash;
-    void *entry;
-    struct qnode *qnode;
-};
+#define hashmap_entry(node, type, member) \
+    ((type *) ((char *) (node) - offsetof(type, member)))
 
 /**
  * \ingroup ds
@@ -43,46 +55,33 @@ struct hashmap_node {
  */
 #define hashmap_for(n, h) \
     for (size_t __i__ = 0; __i__ < (h)->buckets_nr; ++__i__) \
-        queue_for ((n), &(h)->buckets[__i__])
-
-/**
- * \ingroup ds
- * \brief create a new statically allocated hashmap
- */
-#define HASHMAP_NEW(n) &(struct hashmap) {\
-    .count = 0, \
-    .buckets_nr = HASHMAP_DEFAULT, \
-    .buckets = &(struct queue[n]){0}, \
-}
+        for (struct hashmap_node *(n) = (h)->buckets[__i__]; (n); (n) = (n)->next)
 
 /**
  * \ingroup ds
  * \brief create a new dynamically allocated hashmap
  */
-static inline struct hashmap *hashmap_new(size_t n, int (*eq)(void *, void *))
+static inline struct hashmap *hashmap_new(size_t n, int (*eq)(struct hashmap_node *, void *))
 {
-    if (!n) n = HASHMAP_DEFAULT;
+    size_t buckets_nr = HASHMAP_DEFAULT;
+
+    while (buckets_nr < n)
+        buckets_nr <<= 1;
 
     struct hashmap *hashmap;
 
-    hashmap = kmalloc(sizeof(struct hashmap), &M_HASHMAP, 0);
+    hashmap = kmalloc(sizeof(struct hashmap), &M_HASHMAP, M_ZERO);
     if (!hashmap) return NULL;
 
-    //printk("hashmap_new(%d) -> %p\n", n, hashmap);
-
-    memset(hashmap, 0, sizeof(struct hashmap));
-
     hashmap->eq = eq;
-    hashmap->buckets = kmalloc(n * sizeof(struct queue), &M_QUEUE, 0);
+    hashmap->buckets = kmalloc(buckets_nr * sizeof(struct hashmap_node *), &M_HASHMAP, M_ZERO);
 
     if (!hashmap->buckets) {
         kfree(hashmap);
         return NULL;
     }
 
-    memset(hashmap->buckets, 0, n * sizeof(struct queue));
-
-    hashmap->buckets_nr = n;
+    hashmap->buckets_nr = buckets_nr;
 
     return hashmap;
 }
@@ -90,96 +89,101 @@ static inline struct hashmap *hashmap_new(size_t n, int (*eq)(void *, void *))
 /**
  * \ingroup ds
  * \brief get the digest of the hash function
+ *
+ * 32-bit FNV-1a over the key bytes followed by a final avalanche so
+ * that the low bits used to pick a bucket depend on the whole key.
  */
 static inline hash_t hashmap_digest(const void *_id, size_t size)
 {
-    const char *id = (const char *) _id;
+    const unsigned char *id = (const unsigned char *) _id;
 
-    hash_t hash = 0;
+    uint32_t hash = 2166136261U;
 
     while (size) {
-        hash += *id;
+        hash ^= *id;
+        hash *= 16777619U;
         ++id;
         --size;
     }
 
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+
     return hash;
 }
 
-/**
- * \ingroup ds
- * \brief insert a new element into a hashmap
- */
-static inline int hashmap_insert(struct hashmap *hashmap, hash_t hash, void *entry) 
+static inline void __hashmap_link(struct hashmap_node **buckets, size_t buckets_nr, struct hashmap_node *node)
 {
-    if (!hashmap || !hashmap->buckets_nr || !hashmap->buckets)
-        return -EINVAL;
+    size_t idx = node->hash & (buckets_nr - 1);
 
-    struct hashmap_node *node;
-    
-    node = kmalloc(sizeof(struct hashmap_node), &M_HASHMAP_NODE, 0);
+    node->next = buckets[idx];
+    buckets[idx] = node;
+}
 
-    if (!node) return -ENOMEM;
+/* double the number of buckets, keeps the old ones on failure */
+static inline void __hashmap_grow(struct hashmap *hashmap)
+{
+    size_t buckets_nr = hashmap->buckets_nr << 1;
+    struct hashmap_node **buckets;
 
-    node->hash  = hash;
-    node->entry = entry;
+    buckets = kmalloc(buckets_nr * sizeof(struct hashmap_node *), &M_HASHMAP, M_ZERO);
 
-    size_t idx = hash % hashmap->buckets_nr;
+    if (!buckets)
+        return;
 
-    node->qnode = enqueue(&hashmap->buckets[idx], node);
+    for (size_t i = 0; i < hashmap->buckets_nr; ++i) {
+        struct hashmap_node *node = hashmap->buckets[i], *next;
 
-    if (!node->qnode) {
-        kfree(node);
-        return -ENOMEM;
+        for (; node; node = next) {
+            next = node->next;
+            __hashmap_link(buckets, buckets_nr, node);
+        }
     }
 
-    hashmap->count++;
+    kfree(hashmap->buckets);
 
-    return 0;
+    hashmap->buckets = buckets;
+    hashmap->buckets_nr = buckets_nr;
 }
 
 /**
  * \ingroup ds
- * \brief lookup for an element in the hashmap using the hash and the key
+ * \brief insert a new element into a hashmap
  */
-static inline struct hashmap_node *hashmap_lookup(struct hashmap *hashmap, hash_t hash, void *key)
+static inline int hashmap_insert(struct hashmap *hashmap, hash_t hash, struct hashmap_node *node)
 {
-    if (!hashmap || !hashmap->buckets || !hashmap->buckets_nr || !hashmap->count)
-        return NULL;
+    if (!hashmap || !hashmap->buckets_nr || !hashmap->buckets || !node)
+        return -EINVAL;
 
-    size_t idx = hash % hashmap->buckets_nr;
-    struct queue *queue = &hashmap->buckets[idx];
+    if (hashmap->count >= hashmap->buckets_nr)
+        __hashmap_grow(hashmap);
 
-    queue_for (node, queue) {
-        struct hashmap_node *hnode = (struct hashmap_node *) node->value;
-        if (hnode && hnode->hash == hash && hashmap->eq(hnode->entry, key))
-            return hnode;
-    }
+    node->hash = hash;
+    __hashmap_link(hashmap->buckets, hashmap->buckets_nr, node);
 
-    return NULL;
+    hashmap->count++;
+
+    return 0;
 }
 
 /**
  * \ingroup ds
- * \brief replace an element in the hashmap using the hash and the key
+ * \brief lookup for an element in the hashmap using the hash and the key
  */
-static inline int hashmap_replace(struct hashmap *hashmap, hash_t hash, void *key, void *entry)
+static inline struct hashmap_node *hashmap_lookup(struct hashmap *hashmap, hash_t hash, void *key)
 {
     if (!hashmap || !hashmap->buckets || !hashmap->buckets_nr || !hashmap->count)
-        return -EINVAL;
+        return NULL;
 
-    size_t idx = hash % hashmap->buckets_nr;
-    struct queue *queue = &hashmap->buckets[idx];
+    size_t idx = hash & (hashmap->buckets_nr - 1);
 
-    queue_for (node, queue) {
-        struct hashmap_node *hnode = (struct hashmap_node *) node->value;
-        if (hnode && hnode->hash == hash && hashmap->eq(hnode->entry, key)) {
-            hnode->entry = entry;
-            return 0;
-        }
+    for (struct hashmap_node *node = hashmap->buckets[idx]; node; node = node->next) {
+        if (node->hash == hash && hashmap->eq(node, key))
+            return node;
     }
 
-    return hashmap_insert(hashmap, hash, entry);
+    return NULL;
 }
 
 /**
@@ -188,45 +192,32 @@ static inline int hashmap_replace(struct hashmap *hashmap, hash_t hash, void *ke
  */
 static inline void hashmap_node_remove(struct hashmap *hashmap, struct hashmap_node *node)
 {
-    if (!hashmap || !hashmap->buckets ||
-        !hashmap->buckets_nr || !node || !node->qnode)
+    if (!hashmap || !hashmap->buckets || !hashmap->buckets_nr || !node)
         return;
 
-    size_t idx = node->hash % hashmap->buckets_nr;
-    struct queue *queue = &hashmap->buckets[idx];
-
-    queue_node_remove(queue, node->qnode);
-    kfree(node);
-    hashmap->count--;
-}
-
-#if 0
-static inline void hashmap_remove(struct hashmap *hashmap, hash_t id)
-{
-    struct hashmap_node *node = hashmap_lookup(hashmap, id);
+    size_t idx = node->hash & (hashmap->buckets_nr - 1);
+    struct hashmap_node **link = &hashmap->buckets[idx];
 
-    if (node)
-        hashmap_node_remove(hashmap, node);
+    for (; *link; link = &(*link)->next) {
+        if (*link == node) {
+            *link = node->next;
+            node->next = NULL;
+            hashmap->count--;
+            return;
+        }
+    }
 }
-#endif
 
 /**
  * \ingroup ds
  * \brief free all resources associated with a hashmap
+ *
+ * Elements are owned by the caller and are not freed.
  */
 static inline void hashmap_free(struct hashmap *hashmap)
 {
-    for (size_t i = 0; i < hashmap->buckets_nr; ++i) {
-        struct queue *queue = &hashmap->buckets[i];
-
-        struct hashmap_node *node;
-        while ((node = dequeue(queue))) {
-            kfree(node);
-        }
-    }
-
     kfree(hashmap->buckets);
     kfree(hashmap);
 }
 
-#endif /* ! _DS_QUEUE_H */
+#endif /* ! _DS_HASHMAP_H */
@@ -174,4 +174,68 @@ static inline void queue_node_remove(struct queue *queue, struct qnode *node)
     return;
 }
 
+/*
+ * Intrusive queues
+ *
+ * The following variants work on nodes owned by the caller, usually
+ * embedded in the element itself, so linking never allocates and can't
+ * fail. A queue must be used either with these or with the allocating
+ * functions above, never with both.
+ */
+
+/**
+ * \ingroup ds
+ * \brief append a caller owned node holding `value` to a queue
+ */
+static inline void queue_node_append(struct queue *queue, struct qnode *node, void *value)
+{
+    node->value = value;
+    node->next  = NULL;
+    node->prev  = queue->tail;
+
+    if (queue->tail)
+        queue->tail->next = node;
+    else
+        queue->head = node;
+
+    queue->tail = node;
+    ++queue->count;
+}
+
+/**
+ * \ingroup ds
+ * \brief unlink a caller owned node from a queue without freeing it
+ */
+static inline void queue_node_unlink(struct queue *queue, struct qnode *node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        queue->head = node->next;
+
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        queue->tail = node->prev;
+
+    node->prev = node->next = NULL;
+    --queue->count;
+}
+
+/**
+ * \ingroup ds
+ * \brief unlink the first caller owned node of a queue and return its value
+ */
+static inline void *queue_node_pop(struct queue *queue)
+{
+    struct qnode *node = queue->head;
+
+    if (!node)
+        return NULL;
+
+    queue_node_unlink(queue, node);
+
+    return node->value;
+}
+
 #endif /* ! _DS_QUEUE_H */
@@ -0,0 +1,315 @@
+#ifndef _DS_RADIX_H
+#define _DS_RADIX_H
+
+#include <core/system.h>
+
+struct radix_tree;
+struct radix_node;
+
+#include <core/string.h>
+#include <bits/errno.h>
+
+/*
+ * Radix tree mapping integer indices to pointers. Each level resolves
+ * RADIX_TREE_SHIFT bits of the index and the tree only grows as tall
+ * as the largest index stored needs, so dense small indices (page
+ * numbers inside an object) are found in one or two steps.
+ */
+
+#define RADIX_TREE_SHIFT    6
+#define RADIX_TREE_SLOTS    (1UL << RADIX_TREE_SHIFT)
+#define RADIX_TREE_MASK     (RADIX_TREE_SLOTS - 1)
+#define RADIX_TREE_BITS     (sizeof(size_t) * 8)
+#define RADIX_TREE_MAX_HEIGHT ((RADIX_TREE_BITS + RADIX_TREE_SHIFT - 1) / RADIX_TREE_SHIFT)
+
+/**
+ * \ingroup ds
+ * \brief radix tree node
+ */
+struct radix_node {
+    void *slots[RADIX_TREE_SLOTS];
+    size_t count;   /* used slots */
+};
+
+/**
+ * \ingroup ds
+ * \brief radix tree
+ */
+struct radix_tree {
+    struct radix_node *root;
+    size_t height;
+    size_t count;
+};
+
+/**
+ * \ingroup ds
+ * \brief iterate over radix tree elements in index order
+ */
+#define radix_tree_for(item, idx, tree) \
+    for (size_t idx = 0; ((item) = radix_tree_next((tree), &idx)); ++idx)
+
+static inline size_t __radix_tree_maxindex(size_t height)
+{
+    size_t shift = height * RADIX_TREE_SHIFT;
+    return shift >= RADIX_TREE_BITS? ~(size_t) 0 : ((size_t) 1 << shift) - 1;
+}
+
+static inline struct radix_node *__radix_node_new(void)
+{
+    return kmalloc(sizeof(struct radix_node), &M_RADIX_NODE, M_ZERO);
+}
+
+static inline void **__radix_tree_slot(struct radix_tree *tree, size_t index)
+{
+    if (!tree->root || index > __radix_tree_maxindex(tree->height))
+        return NULL;
+
+    struct radix_node *node = tree->root;
+
+    for (size_t h = tree->height; h > 1; --h) {
+        node = node->slots[(index >> ((h - 1) * RADIX_TREE_SHIFT)) & RADIX_TREE_MASK];
+
+        if (!node)
+            return NULL;
+    }
+
+    return &node->slots[index & RADIX_TREE_MASK];
+}
+
+/**
+ * \ingroup ds
+ * \brief lookup the element stored at `index`
+ */
+static inline void *radix_tree_lookup(struct radix_tree *tree, size_t index)
+{
+    void **slot = __radix_tree_slot(tree, index);
+    return slot? *slot : NULL;
+}
+
+/**
+ * \ingroup ds
+ * \brief store `item` at `index`
+ *
+ * \return 0 on success, -EEXIST if `index` is in use or -ENOMEM
+ */
+static inline int radix_tree_insert(struct radix_tree *tree, size_t index, void *item)
+{
+    if (!item)
+        return -EINVAL;
+
+    /* grow the tree until it covers `index` */
+    while (!tree->root || index > __radix_tree_maxindex(tree->height)) {
+        struct radix_node *node = __radix_node_new();
+
+        if (!node)
+            return -ENOMEM;
+
+        if (tree->root) {
+            node->slots[0] = tree->root;
+            node->count = 1;
+        } else {
+            tree->height = 0;
+        }
+
+        tree->root = node;
+        tree->height++;
+    }
+
+    struct radix_node *node = tree->root;
+
+    for (size_t h = tree->height; h > 1; --h) {
+        size_t i = (index >> ((h - 1) * RADIX_TREE_SHIFT)) & RADIX_TREE_MASK;
+
+        if (!node->slots[i]) {
+            if (!(node->slots[i] = __radix_node_new()))
+                return -ENOMEM;
+
+            node->count++;
+        }
+
+        node = node->slots[i];
+    }
+
+    size_t i = index & RADIX_TREE_MASK;
+
+    if (node->slots[i])
+        return -EEXIST;
+
+    node->slots[i] = item;
+    node->count++;
+    tree->count++;
+
+    return 0;
+}
+
+/**
+ * \ingroup ds
+ * \brief replace the element stored at `index`
+ *
+ * \return the old element or NULL (and nothing stored) if there is none
+ */
+static inline void *radix_tree_replace(struct radix_tree *tree, size_t index, void *item)
+{
+    void **slot = __radix_tree_slot(tree, index);
+
+    if (!slot || !*slot || !item)
+        return NULL;
+
+    void *old = *slot;
+    *slot = item;
+
+    return old;
+}
+
+/**
+ * \ingroup ds
+ * \brief remove the element stored at `index`, freeing emptied nodes
+ *
+ * \return the removed element or NULL
+ */
+static inline void *radix_tree_delete(struct radix_tree *tree, size_t index)
+{
+    if (!tree->root || index > __radix_tree_maxindex(tree->height))
+        return NULL;
+
+    struct radix_node *path[RADIX_TREE_MAX_HEIGHT] = {0};
+    size_t slot[RADIX_TREE_MAX_HEIGHT] = {0};
+
+    struct radix_node *node = tree->root;
+
+    for (size_t h = tree->height; h > 0; --h) {
+        path[h - 1] = node;
+        slot[h - 1] = (index >> ((h - 1) * RADIX_TREE_SHIFT)) & RADIX_TREE_MASK;
+
+        if (h > 1 && !(node = node->slots[slot[h - 1]]))
+            return NULL;
+    }
+
+    void *item = path[0]->slots[slot[0]];
+
+    if (!item)
+        return NULL;
+
+    tree->count--;
+
+    size_t h;
+    for (h = 0; h < tree->height; ++h) {
+        path[h]->slots[slot[h]] = NULL;
+
+        if (--path[h]->count)
+            break;
+
+        kfree(path[h]);
+    }
+
+    if (h == tree->height) {
+        tree->root = NULL;
+        tree->height = 0;
+        return item;
+    }
+
+    /* shrink while everything lives below the first slot */
+    while (tree->height > 1 && tree->root->count == 1 && tree->root->slots[0]) {
+        struct radix_node *root = tree->root;
+        tree->root = root->slots[0];
+        tree->height--;
+        kfree(root);
+    }
+
+    return item;
+}
+
+static inline void *__radix_tree_next(struct radix_node *node, size_t height,
+        size_t base, size_t start, size_t *index)
+{
+    size_t shift = (height - 1) * RADIX_TREE_SHIFT;
+    size_t i = start > base? (start - base) >> shift : 0;
+
+    for (; i < RADIX_TREE_SLOTS; ++i) {
+        void *slot = node->slots[i];
+
+        if (!slot)
+            continue;
+
+        size_t child = base + (i << shift);
+
+        if (height == 1) {
+            *index = child;
+            return slot;
+        }
+
+        void *item = __radix_tree_next(slot, height - 1, child, start, index);
+
+        if (item)
+            return item;
+    }
+
+    return NULL;
+}
+
+/**
+ * \ingroup ds
+ * \brief find the first element at or after `*index`
+ *
+ * `*index` is updated to the index of the returned element.
+ */
+static inline void *radix_tree_next(struct radix_tree *tree, size_t *index)
+{
+    if (!tree->root || *index > __radix_tree_maxindex(tree->height))
+        return NULL;
+
+    return __radix_tree_next(tree->root, tree->height, 0, *index, index);
+}
+
+/**
+ * \ingroup ds
+ * \brief lookup `nr` consecutive indices starting at `first`
+ *
+ * `items[i]` is set to the element at `first + i` or NULL.
+ *
+ * \return number of elements found
+ */
+static inline size_t radix_tree_gang_lookup(struct radix_tree *tree, size_t first, size_t nr, void **items)
+{
+    size_t found = 0, index = first;
+    void *item;
+
+    memset(items, 0, nr * sizeof(void *));
+
+    while ((item = radix_tree_next(tree, &index)) && index - first < nr) {
+        items[index - first] = item;
+        found++;
+
+        if (!++index)
+            break;
+    }
+
+    return found;
+}
+
+static inline void __radix_tree_free(struct radix_node *node, size_t height)
+{
+    if (height > 1) {
+        for (size_t i = 0; i < RADIX_TREE_SLOTS; ++i)
+            if (node->slots[i])
+                __radix_tree_free(node->slots[i], height - 1);
+    }
+
+    kfree(node);
+}
+
+/**
+ * \ingroup ds
+ * \brief free all nodes of a radix tree, elements are left alone
+ */
+static inline void radix_tree_free(struct radix_tree *tree)
+{
+    if (tree->root)
+        __radix_tree_free(tree->root, tree->height);
+
+    tree->root   = NULL;
+    tree->height = 0;
+    tree->count  = 0;
+}
+
+#endif /* ! _DS_RADIX_H */
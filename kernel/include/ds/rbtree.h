@@ -0,0 +1,401 @@
+#ifndef _DS_RBTREE_H
+#define _DS_RBTREE_H
+
+#include <core/system.h>
+
+/*
+ * Intrusive red-black tree, the node is embedded inside the element
+ * and the element is recovered with `rbtree_entry`.  Users may keep
+ * per-subtree data in the element (augmented tree), the `augment`
+ * callback is then invoked for each node whose children changed and
+ * must recompute that node's data from its own and its children's.
+ */
+
+#define RB_RED      0
+#define RB_BLACK    1
+
+/**
+ * \ingroup ds
+ * \brief red-black tree node
+ */
+struct rbnode {
+    struct rbnode *parent;
+    struct rbnode *left;
+    struct rbnode *right;
+    int color;
+};
+
+/**
+ * \ingroup ds
+ * \brief red-black tree
+ */
+struct rbtree {
+    struct rbnode *root;
+    size_t count;
+};
+
+typedef void (*rbtree_augment_t)(struct rbnode *node);
+
+/**
+ * \ingroup ds
+ * \brief get the element containing a tree node
+ */
+#define rbtree_entry(node, type, member) \
+    ((type *) ((char *) (node) - offsetof(type, member)))
+
+/**
+ * \ingroup ds
+ * \brief iterate over tree nodes in order
+ */
+#define rbtree_for(n, t) for (struct rbnode *(n) = rbtree_first(t); (n); (n) = rbtree_next(n))
+
+static inline struct rbnode *rbtree_first(struct rbtree *tree)
+{
+    struct rbnode *node = tree->root;
+
+    if (node)
+        while (node->left)
+            node = node->left;
+
+    return node;
+}
+
+static inline struct rbnode *rbtree_last(struct rbtree *tree)
+{
+    struct rbnode *node = tree->root;
+
+    if (node)
+        while (node->right)
+            node = node->right;
+
+    return node;
+}
+
+static inline struct rbnode *rbtree_next(struct rbnode *node)
+{
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return node;
+    }
+
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+
+    return node->parent;
+}
+
+static inline struct rbnode *rbtree_prev(struct rbnode *node)
+{
+    if (node->left) {
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return node;
+    }
+
+    while (node->parent && node == node->parent->left)
+        node = node->parent;
+
+    return node->parent;
+}
+
+static inline struct rbnode *__rbtree_leftmost_leaf(struct rbnode *node)
+{
+    for (;;) {
+        if (node->left)
+            node = node->left;
+        else if (node->right)
+            node = node->right;
+        else
+            return node;
+    }
+}
+
+/**
+ * \ingroup ds
+ * \brief first node in post-order (children before parents)
+ *
+ * Post-order walks allow freeing nodes while iterating since
+ * `rbtree_next_postorder` never looks at already visited nodes.
+ */
+static inline struct rbnode *rbtree_first_postorder(struct rbtree *tree)
+{
+    return tree->root? __rbtree_leftmost_leaf(tree->root) : NULL;
+}
+
+static inline struct rbnode *rbtree_next_postorder(struct rbnode *node)
+{
+    struct rbnode *parent = node->parent;
+
+    if (parent && node == parent->left && parent->right)
+        return __rbtree_leftmost_leaf(parent->right);
+
+    return parent;
+}
+
+/**
+ * \ingroup ds
+ * \brief recompute augmented data from `node` up to the root
+ */
+static inline void rbtree_propagate(struct rbnode *node, rbtree_augment_t augment)
+{
+    if (!augment)
+        return;
+
+    for (; node; node = node->parent)
+        augment(node);
+}
+
+static inline void __rbtree_replace(struct rbtree *tree, struct rbnode *old, struct rbnode *new)
+{
+    struct rbnode *parent = old->parent;
+
+    if (!parent)
+        tree->root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+
+    if (new)
+        new->parent = parent;
+}
+
+static inline void __rbtree_rotate_left(struct rbtree *tree, struct rbnode *x, rbtree_augment_t augment)
+{
+    struct rbnode *y = x->right;
+
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+
+    __rbtree_replace(tree, x, y);
+
+    y->left = x;
+    x->parent = y;
+
+    if (augment) {
+        augment(x);
+        augment(y);
+    }
+}
+
+static inline void __rbtree_rotate_right(struct rbtree *tree, struct rbnode *x, rbtree_augment_t augment)
+{
+    struct rbnode *y = x->left;
+
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+
+    __rbtree_replace(tree, x, y);
+
+    y->right = x;
+    x->parent = y;
+
+    if (augment) {
+        augment(x);
+        augment(y);
+    }
+}
+
+#define __RB_IS_BLACK(n) (!(n) || (n)->color == RB_BLACK)
+
+/**
+ * \ingroup ds
+ * \brief link `node` at `*link` below `parent` and rebalance
+ *
+ * `parent` and `link` are found by the caller while descending the
+ * tree, `link` is either `&parent->left`, `&parent->right` or
+ * `&tree->root` for an empty tree.
+ */
+static inline void rbtree_insert(struct rbtree *tree, struct rbnode *node,
+        struct rbnode *parent, struct rbnode **link, rbtree_augment_t augment)
+{
+    node->parent = parent;
+    node->left   = NULL;
+    node->right  = NULL;
+    node->color  = RB_RED;
+
+    *link = node;
+    ++tree->count;
+
+    rbtree_propagate(node, augment);
+
+    struct rbnode *p, *g, *u;
+
+    while ((p = node->parent) && p->color == RB_RED) {
+        g = p->parent;
+
+        if (p == g->left) {
+            u = g->right;
+
+            if (u && u->color == RB_RED) {
+                p->color = RB_BLACK;
+                u->color = RB_BLACK;
+                g->color = RB_RED;
+                node = g;
+                continue;
+            }
+
+            if (node == p->right) {
+                __rbtree_rotate_left(tree, p, augment);
+                node = p;
+                p = node->parent;
+            }
+
+            p->color = RB_BLACK;
+            g->color = RB_RED;
+            __rbtree_rotate_right(tree, g, augment);
+        } else {
+            u = g->left;
+
+            if (u && u->color == RB_RED) {
+                p->color = RB_BLACK;
+                u->color = RB_BLACK;
+                g->color = RB_RED;
+                node = g;
+                continue;
+            }
+
+            if (node == p->left) {
+                __rbtree_rotate_right(tree, p, augment);
+                node = p;
+                p = node->parent;
+            }
+
+            p->color = RB_BLACK;
+            g->color = RB_RED;
+            __rbtree_rotate_left(tree, g, augment);
+        }
+    }
+
+    tree->root->color = RB_BLACK;
+}
+
+static inline void __rbtree_erase_fixup(struct rbtree *tree, struct rbnode *x,
+        struct rbnode *parent, rbtree_augment_t augment)
+{
+    struct rbnode *w;
+
+    while (x != tree->root && __RB_IS_BLACK(x)) {
+        if (x == parent->left) {
+            w = parent->right;
+
+            if (w->color == RB_RED) {
+                w->color = RB_BLACK;
+                parent->color = RB_RED;
+                __rbtree_rotate_left(tree, parent, augment);
+                w = parent->right;
+            }
+
+            if (__RB_IS_BLACK(w->left) && __RB_IS_BLACK(w->right)) {
+                w->color = RB_RED;
+                x = parent;
+                parent = x->parent;
+            } else {
+                if (__RB_IS_BLACK(w->right)) {
+                    w->left->color = RB_BLACK;
+                    w->color = RB_RED;
+                    __rbtree_rotate_right(tree, w, augment);
+                    w = parent->right;
+                }
+
+                w->color = parent->color;
+                parent->color = RB_BLACK;
+                w->right->color = RB_BLACK;
+                __rbtree_rotate_left(tree, parent, augment);
+                x = tree->root;
+                break;
+            }
+        } else {
+            w = parent->left;
+
+            if (w->color == RB_RED) {
+                w->color = RB_BLACK;
+                parent->color = RB_RED;
+                __rbtree_rotate_right(tree, parent, augment);
+                w = parent->left;
+            }
+
+            if (__RB_IS_BLACK(w->left) && __RB_IS_BLACK(w->right)) {
+                w->color = RB_RED;
+                x = parent;
+                parent = x->parent;
+            } else {
+                if (__RB_IS_BLACK(w->left)) {
+                    w->right->color = RB_BLACK;
+                    w->color = RB_RED;
+                    __rbtree_rotate_left(tree, w, augment);
+                    w = parent->left;
+                }
+
+                w->color = parent->color;
+                parent->color = RB_BLACK;
+                w->left->color = RB_BLACK;
+                __rbtree_rotate_right(tree, parent, augment);
+                x = tree->root;
+                break;
+            }
+        }
+    }
+
+    if (x)
+        x->color = RB_BLACK;
+}
+
+/**
+ * \ingroup ds
+ * \brief remove `node` from the tree and rebalance
+ */
+static inline void rbtree_erase(struct rbtree *tree, struct rbnode *node, rbtree_augment_t augment)
+{
+    struct rbnode *x, *parent;
+    int color;
+
+    if (!node->left || !node->right) {
+        x = node->left? node->left : node->right;
+        parent = node->parent;
+        color  = node->color;
+        __rbtree_replace(tree, node, x);
+    } else {
+        /* replace with in-order successor */
+        struct rbnode *y = node->right;
+
+        while (y->left)
+            y = y->left;
+
+        x = y->right;
+        color = y->color;
+
+        if (y->parent == node) {
+            parent = y;
+        } else {
+            parent = y->parent;
+            parent->left = x;
+            if (x)
+                x->parent = parent;
+
+            y->right = node->right;
+            y->right->parent = y;
+        }
+
+        __rbtree_replace(tree, node, y);
+        y->left = node->left;
+        y->left->parent = y;
+        y->color = node->color;
+    }
+
+    --tree->count;
+
+    rbtree_propagate(parent, augment);
+
+    if (color == RB_BLACK)
+        __rbtree_erase_fixup(tree, x, parent, augment);
+}
+
+#undef __RB_IS_BLACK
+
+#endif /* ! _DS_RBTREE_H */
@@ -199,4 +199,6 @@ struct winsize {
 #define SIOCDEVPRIVATE      0x89F0
 #define SIOCPROTOPRIVATE    0x89E0
 
+#define BLKGETSIZE          0x1260  /* size in 512 byte sectors */
+
 #endif  /* ! _FS_IOCTL_H */
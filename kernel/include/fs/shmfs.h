@@ -0,0 +1,12 @@
+#ifndef _FS_SHMFS_H
+#define _FS_SHMFS_H
+
+#include <fs/vfs.h>
+
+extern struct fs shmfs;
+extern struct vnode *shmfs_root;
+
+int shmfs_open(const char *name, int oflags, mode_t mode, struct uio *uio, struct vnode **ref);
+int shmfs_unlink(const char *name, struct uio *uio);
+
+#endif /* ! _FS_SHMFS_H */
@@ -36,6 +36,7 @@ struct fops {
 #include <bits/errno.h>
 #include <sys/proc.h>
 #include <ds/queue.h>
+#include <ds/hashmap.h>
 #include <fs/stat.h>
 #include <mm/vm.h>
 
@@ -135,6 +136,9 @@ struct vnode {
 
     /** virtual memory object associated with vnode */
     struct vm_object *vm_object;
+
+    /** node in the filesystem's `vcache` */
+    struct hashmap_node vcache_node;
 };
 
 struct file {
@@ -191,6 +195,8 @@ int     vfs_vcreat(struct vnode *dir, const char *fn, struct uio *uio, struct vn
 int     vfs_vmkdir(struct vnode *dir, const char *dname, struct uio *uio, struct vnode **ref);
 int     vfs_vunlink(struct vnode *dir, const char *fn, struct uio *uio);
 int     vfs_vget(struct vnode *super, ino_t ino, struct vnode **vnode);
+void    vfs_vhold(struct vnode *vnode);
+void    vfs_vrele(struct vnode *vnode);
 
 int     vfs_map(struct vm_space *vm_space, struct vm_entry *vm_entry);
 
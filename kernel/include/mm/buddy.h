@@ -14,6 +14,9 @@
 #define BUDDY_ZONE_DMA      0
 #define BUDDY_ZONE_NORMAL   1
 
+/** returned by `buddy_alloc` on failure */
+#define BUDDY_NONE          ((paddr_t) -1)
+
 int     buddy_setup(size_t total_mem);
 paddr_t buddy_alloc(int zone, size_t size);
 void    buddy_free(int zone, paddr_t paddr, size_t size);
@@ -1,28 +1,82 @@
 #ifndef _MM_KVMEM_H
 #define _MM_KVMEM_H
 
+struct kvmem_cache;
+struct kvmem_slab;
+
 struct malloc_type {
     const char *name;
     const char *desc;
     size_t nr;
     size_t total;
     struct qnode *qnode;
+
+    /** object cache serving allocations of this type (optional) */
+    struct kvmem_cache *cache;
+};
+
+/**
+ * \ingroup mm
+ * \brief object cache
+ *
+ * Fixed-size objects of a malloc type are carved out of page-sized slabs
+ * instead of the general kvmem heap, allocation and release are O(1).
+ */
+struct kvmem_cache {
+    /** malloc type served by the cache */
+    struct malloc_type *type;
+
+    /** size of a single object */
+    size_t size;
+
+    /** constructor, called once per object when its slab is created */
+    void (*ctor)(void *obj);
+
+    /** size of an object slot (object + free list link) */
+    size_t slot;
+
+    /** number of objects per slab */
+    size_t nr;
+
+    /** slabs with free objects */
+    struct kvmem_slab *partial;
+
+    /** one completely free slab kept around to avoid thrashing */
+    struct kvmem_slab *empty;
+
+    /** number of slabs owned by the cache */
+    size_t slabs_nr;
+
+    /** number of objects handed out */
+    size_t inuse;
 };
 
 #define M_ZERO  0x0001
 
 #define MALLOC_DECLARE(type) extern struct malloc_type (type)
-#define MALLOC_DEFINE(type, name, desc) struct malloc_type (type) = {(name), (desc), 0, 0, NULL}
+#define MALLOC_DEFINE(type, name, desc) struct malloc_type (type) = {(name), (desc), 0, 0, NULL, NULL}
+
+/** define a malloc type backed by an object cache of `objsize` sized objects */
+#define MALLOC_DEFINE_CACHE(mtype, name, desc, objsize, objctor) \
+    MALLOC_DECLARE(mtype); \
+    static struct kvmem_cache __kvmem_cache_##mtype = {.type = &(mtype), .size = (objsize), .ctor = (objctor)}; \
+    struct malloc_type (mtype) = {(name), (desc), 0, 0, NULL, &__kvmem_cache_##mtype}
+
+/** cached heap pages left in place by idle reclamation */
+#define KVMEM_RECLAIM_IDLE_KEEP 32
 
 MALLOC_DECLARE(M_BUFFER);
 MALLOC_DECLARE(M_RINGBUF);
 MALLOC_DECLARE(M_QUEUE);
 MALLOC_DECLARE(M_QNODE);
 MALLOC_DECLARE(M_HASHMAP);
-MALLOC_DECLARE(M_HASHMAP_NODE);
+MALLOC_DECLARE(M_RADIX_NODE);
 
 void *kmalloc(size_t, struct malloc_type *type, int flags);
 void kfree(void *);
+void *kvmem_cache_alloc(struct kvmem_cache *cache);
+void kvmem_cache_free(struct kvmem_cache *cache, void *obj);
+void kvmem_reclaim(size_t keep);
 extern int debug_kmalloc;
 
 #ifdef DEBUG_KMALLOC
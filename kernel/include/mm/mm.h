@@ -8,22 +8,44 @@
 
 #include <boot/boot.h>
 
+struct vm_entry;
+
 #define PF_PRESENT  0x001
 #define PF_READ     0x002
 #define PF_WRITE    0x004
 #define PF_EXEC     0x008
 #define PF_USER     0x010
 
+/** pages worth batching through `mm_page_alloc_bulk` at once */
+#define MM_BULK_NR  16
+
+/** allocation flags: fail instead of dropping cached pages (heap, page tables) */
+#define MM_NORECLAIM    0x0001
+
+/** default number of pre-zeroed pages kept around */
+#define MM_ZERO_POOL_SIZE   64
+
 void mm_setup(struct boot *boot);
 
 struct vm_page *mm_page(paddr_t paddr);
-struct vm_page *mm_page_alloc(void);
+struct vm_page *mm_page_alloc(int flags);
 void   mm_page_incref(paddr_t paddr);
 void   mm_page_decref(paddr_t paddr);
 size_t mm_page_ref(paddr_t paddr);
 void mm_page_dealloc(paddr_t paddr);
+int  mm_page_alloc_bulk(size_t nr, struct vm_page **vm_pages, int flags);
+void mm_page_dealloc_bulk(size_t nr, struct vm_page **vm_pages);
+struct vm_page *mm_page_alloc_order(size_t order);
+struct vm_page *mm_page_alloc_zero(void);
+void mm_reserve_fill(struct vm_entry *skip);
+void mm_zero_pool_setup(void);
+void mm_zero_pool_fill(void);
+
+/** page of zeros mapped read-only by untouched anonymous memory */
+extern struct vm_page *mm_zero_page;
 
 int  mm_page_map(struct pmap *pmap, vaddr_t vaddr, paddr_t paddr, int flags);
+int  mm_page_unmap(struct pmap *pmap, vaddr_t vaddr);
 int  mm_map(struct pmap *pmap, paddr_t paddr, vaddr_t vaddr, size_t size, int flags);
 void mm_unmap(struct pmap *pmap, vaddr_t addr, size_t size);
 void mm_unmap_full(struct pmap *pmap, vaddr_t vaddr, size_t size);
@@ -15,6 +15,7 @@ MALLOC_DECLARE(M_VM_ANON);
 MALLOC_DECLARE(M_VM_AREF);
 
 #include <ds/queue.h>
+#include <ds/rbtree.h>
 
 /** 
  * \ingroup mm
@@ -27,13 +28,17 @@ struct vm_space {
     /** physical memory mapper (arch-specific) */
     struct pmap  *pmap;
 
-    /** virtual memory regions inside the vm space */
-    struct queue  vm_entries;
+    /** virtual memory regions inside the vm space, sorted by base */
+    struct rbtree vm_entries;
+
+    /** last entry returned by `vm_space_find` */
+    struct vm_entry *last_hit;
 };
 
 #include <fs/vfs.h>
 #include <mm/mm.h>
 #include <ds/hashmap.h>
+#include <ds/radix.h>
 
 /* vm entry flags */
 #define VM_KR         0x0001         /**< kernel read */
@@ -46,6 +51,9 @@ struct vm_space {
 #define VM_NOCACHE    0x0040         /**< disable caching */
 #define VM_SHARED     0x0080         /**< shared mapping */
 #define VM_COPY       0x0100         /**< needs copy */
+#define VM_RANDOM     0x0200         /**< random access expected (madvise) */
+#define VM_SEQUENTIAL 0x0400         /**< sequential access expected (madvise) */
+#define VM_LOCKED     0x0800         /**< pages locked in memory (mlock) */
 
 #define VM_KRW  (VM_KR|VM_KW)        /**< kernel read/write */
 #define VM_KRX  (VM_KR|VM_KX)        /**< kernel read/execute */
@@ -57,8 +65,12 @@ struct vm_space {
 #define VM_URWX (VM_UR|VM_UW|VM_UX)  /**< user read/write/execute */
 
 /* object types */
-#define VMOBJ_ZERO    0x0000         /**< zero fill */
+#define VMOBJ_ZERO    0x0000         /**< zero fill (shared anonymous memory) */
 #define VMOBJ_FILE    0x0001         /**< file backed */
+#define VMOBJ_SHM     0x0002         /**< shared memory object (shmfs) */
+
+/** index of the page at offset `off` in an anon or object */
+#define VM_PAGE_IDX(off)  ((size_t) (off) / PAGE_SIZE)
 
 /** 
  * \ingroup mm
@@ -89,10 +101,29 @@ struct vm_entry {
     /** offset inside object */
     size_t off;
 
-    /** the queue node this vm entry is stored in */
-    struct qnode *qnode;
+    /** node in `vm_space->vm_entries` */
+    struct rbnode node;
+
+    /** free space between the previous entry (or 0) and `base` */
+    size_t gap;
+
+    /** largest `gap` inside the subtree rooted at this entry */
+    size_t max_gap;
 };
 
+static inline struct vm_entry *vm_entry_of(struct rbnode *node)
+{
+    return node? rbtree_entry(node, struct vm_entry, node) : NULL;
+}
+
+/**
+ * \ingroup mm
+ * \brief iterate over the vm entries of a vm space in address order
+ */
+#define vm_space_for(e, s) \
+    for (struct vm_entry *(e) = vm_entry_of(rbtree_first(&(s)->vm_entries)); \
+            (e); (e) = vm_entry_of(rbtree_next(&(e)->node)))
+
 /**
  * \ingroup mm
  * \brief pager
@@ -121,6 +152,9 @@ struct vm_aref {
 
     /** flags associated with this aref */
     uint32_t flags;
+
+    /** swap slot + 1 holding the page while swapped out, 0 if none */
+    size_t swap;
 };
 
 /**
@@ -128,8 +162,8 @@ struct vm_aref {
  * \brief anonymous memory object
  */
 struct vm_anon {
-    /** hashmap of `vm_aref` structures loaded/contained in this anon */
-    struct hashmap *arefs;
+    /** `vm_aref` structures loaded/contained in this anon, by page index */
+    struct radix_tree arefs;
 
     /** number of `vm_entry` structures referencing this anon */
     size_t ref;
@@ -143,8 +177,8 @@ struct vm_anon {
  * \brief cached object
  */
 struct vm_object {
-    /** `vm_page`s loaded/contained in the vm object */
-    struct hashmap *pages;
+    /** `vm_page`s loaded/contained in the vm object, by page index */
+    struct radix_tree pages;
 
     /** type of the object */
     int type;
@@ -157,6 +191,12 @@ struct vm_object {
 
     /** pager private data */
     void *p;
+
+    /** read-ahead: offset the next sequential fault is expected at */
+    size_t ra_next;
+
+    /** read-ahead: current window in pages */
+    size_t ra_nr;
 };
 
 /** 
@@ -171,9 +211,19 @@ struct vm_page {
     size_t off; /**< offset of page inside the object */
 
     size_t ref; /**< number of processes referencing this page */
+
+    uint32_t flags; /**< page flags */
+
+    struct vm_page *prev; /**< links in page lists (buddy free list, page cache LRU) */
+    struct vm_page *next;
 };
 
-extern struct vm_page pages[];
+/* vm page flags */
+#define VM_PAGE_DIRTY   0x0001      /**< modified since read from the pager */
+#define VM_PAGE_LRU     0x0002      /**< on the page cache LRU, i.e. evictable */
+
+extern struct vm_page *pages;
+extern size_t pages_nr;
 extern struct vm_space kvm_space;
 
 void kvmem_setup(void);
@@ -188,6 +238,12 @@ int  vm_space_fork(struct vm_space *parent, struct vm_space *child);
 void vm_space_destroy(struct vm_space *vm_space);
 struct vm_entry *vm_space_find(struct vm_space *vm_space, vaddr_t vaddr);
 int  vm_space_insert(struct vm_space *vm_space, struct vm_entry *vm_entry);
+void vm_space_remove(struct vm_space *vm_space, struct vm_entry *vm_entry);
+int  vm_space_resize(struct vm_space *vm_space, struct vm_entry *vm_entry, size_t size);
+int  vm_space_split(struct vm_space *vm_space, vaddr_t va);
+int  vm_space_unmap(struct vm_space *vm_space, vaddr_t va, size_t size);
+int  vm_space_advise(struct vm_space *vm_space, vaddr_t va, size_t size, int advice);
+int  vm_space_lock(struct vm_space *vm_space, vaddr_t va, size_t size, int lock);
 
 /* mm/vm_entry.c */
 struct vm_entry *vm_entry_new(void);
@@ -199,11 +255,31 @@ struct vm_anon *vm_anon_copy(struct vm_anon *vm_anon);
 void vm_anon_incref(struct vm_anon *vm_anon);
 void vm_anon_decref(struct vm_anon *vm_anon);
 void vm_anon_destroy(struct vm_anon *vm_anon);
+void vm_anon_release(struct vm_anon *vm_anon, size_t idx, size_t nr);
+struct vm_anon *vm_anon_split(struct vm_anon *vm_anon, size_t idx);
+
+/* mm/fault.c */
+int  mm_populate(struct vm_space *vm_space, struct vm_entry *vm_entry, vaddr_t sva, vaddr_t eva);
+
+/* mm/swap.c */
+int  swap_on(struct vnode *vnode);
+int  swap_in(struct vm_aref *vm_aref, size_t off);
+void swap_free(size_t slot);
+size_t swap_reclaim(size_t nr, struct vm_entry *skip);
+size_t swap_vm_space(struct vm_space *vm_space, size_t nr);
+
+/* mm/oom.c */
+struct proc *oom_kill(void);
 
 /* mm/vm_object.c */
 struct vm_object *vm_object_vnode(struct vnode *vnode);
+struct vm_object *vm_object_zero(void);
 struct vm_page *vm_object_page_get(struct vm_object *vm_object, size_t off);
-void vm_object_page_insert(struct vm_object *vm_object, struct vm_page *vm_page);
+int  vm_object_page_insert(struct vm_object *vm_object, struct vm_page *vm_page);
+void vm_object_page_touch(struct vm_page *vm_page);
+void vm_object_page_dirty(struct vm_page *vm_page);
+size_t vm_object_reclaim(size_t nr, int writeback);
+void vm_object_truncate(struct vm_object *vm_object, size_t off);
 void vm_object_incref(struct vm_object *vm_object);
 void vm_object_decref(struct vm_object *vm_object);
 
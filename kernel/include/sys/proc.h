@@ -14,6 +14,8 @@ struct session;
 #include <sys/signal.h>
 #include <dev/dev.h>
 
+#include <bits/resource.h>
+
 /**
  * \ingroup sys
  * \brief session
@@ -69,7 +71,10 @@ struct proc {
 
     /** Associated Process Group */
     struct pgroup *pgrp;
-    struct qnode  *pgrp_node;
+    struct qnode   pgrp_node;
+
+    /** Node on all processes queue */
+    struct qnode procs_node;
 
     /** Process name - XXX */
     char *name;
@@ -122,6 +127,9 @@ struct proc {
     /** Registered signal handlers */
     struct sigaction sigaction[SIG_MAX+1];
 
+    /** Resource limits */
+    struct rlimit rlimits[RLIMIT_NLIMITS];
+
     /** Exit status of process */
     int exit;
 
@@ -151,6 +159,7 @@ void proc_fd_release(struct proc *proc, int fd);
 void proc_dump(struct proc *proc);
 
 int  proc_init(struct proc *proc);
+int  proc_as_check(struct proc *proc, size_t size);
 
 #define PROC_EXIT(info, code) ((((info) & 0xff) << 8) | ((code) & 0xff))
 #define PROC_UIO(proc) ((struct uio){.cwd = (proc)->cwd, .uid = (proc)->uid, .gid = (proc)->gid, .mask = (proc)->mask})
@@ -33,13 +33,16 @@ struct thread {
     uintptr_t stack_base;
     size_t    stack_size;
 
-    /** Current sleep queue */
+    /** Current sleep queue, NULL if not sleeping on any */
     struct queue *sleep_queue;
-    struct qnode *sleep_node;
+    struct qnode sleep_node;
 
-    /** Scheduler queue */
+    /** Scheduler queue, NULL if not queued */
     struct queue *sched_queue;
-    struct qnode *sched_node;
+    struct qnode sched_node;
+
+    /** Node on owner's threads queue */
+    struct qnode owner_node;
 
     /** Arch specific data */
     void *arch;
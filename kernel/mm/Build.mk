@@ -5,5 +5,7 @@ obj-y += vm_entry.o
 obj-y += vm_anon.o
 obj-y += vm_object.o
 obj-y += fault.o
+obj-y += swap.o
+obj-y += oom.o
 obj-y += buddy.o
 obj-y += kvmem.o
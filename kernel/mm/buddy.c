@@ -13,6 +13,7 @@
 #include <ds/bitmap.h>
 #include <ds/buddy.h>
 #include <mm/buddy.h>
+#include <mm/vm.h>
 #include <boot/boot.h>
 
 size_t k_total_mem, k_used_mem;
@@ -36,31 +37,66 @@ uintptr_t buddy_zone_offset[BUDDY_ZONE_NR+1] = {
     [BUDDY_ZONE_NR]      = (uintptr_t) -1,
 };
 
-static size_t buddy_recursive_alloc(int zone, size_t order)
+#define BUDDY_BS(order)     (BUDDY_MIN_BS << (order))
+
+/* first page of block `idx` of `order` in `zone` */
+static inline struct vm_page *buddy_page(int zone, size_t order, size_t idx)
 {
-    if (order > BUDDY_MAX_ORDER)
-        return -1;
+    return &pages[(buddy_zone_offset[zone] + idx * BUDDY_BS(order)) / PAGE_SIZE];
+}
 
-    /* Check if there is a free bit in current order */
-    if (buddies[zone][order].usable) {
-        /* Search for a free bit in current order */
-        for (size_t i = buddies[zone][order].first_free_idx; i <= buddies[zone][order].bitmap.max_idx; ++i) {
+static inline size_t buddy_page_idx(int zone, size_t order, struct vm_page *vm_page)
+{
+    return (vm_page->paddr - buddy_zone_offset[zone]) / BUDDY_BS(order);
+}
 
-            /* If bit at i is not checked */
-            if (!bitmap_check(&buddies[zone][order].bitmap, i)) {
+static inline void buddy_list_push(int zone, size_t order, size_t idx)
+{
+    struct buddy *buddy = &buddies[zone][order];
+    struct vm_page *vm_page = buddy_page(zone, order, idx);
 
-                /* Mark the bit as used */
-                bitmap_set(&buddies[zone][order].bitmap, i);
-                buddies[zone][order].usable--;
+    vm_page->paddr = buddy_zone_offset[zone] + idx * BUDDY_BS(order);
+    vm_page->prev  = NULL;
+    vm_page->next  = buddy->free_list;
 
-                /* Shift first_free_idx to search after child_idx */
-                buddies[zone][order].first_free_idx = i + 1;
+    if (buddy->free_list)
+        buddy->free_list->prev = vm_page;
 
-                return i;
-            }                
-        }
+    buddy->free_list = vm_page;
+}
 
+static inline void buddy_list_remove(int zone, size_t order, struct vm_page *vm_page)
+{
+    struct buddy *buddy = &buddies[zone][order];
+
+    if (vm_page->prev)
+        vm_page->prev->next = vm_page->next;
+    else
+        buddy->free_list = vm_page->next;
+
+    if (vm_page->next)
+        vm_page->next->prev = vm_page->prev;
+
+    vm_page->prev = vm_page->next = NULL;
+}
+
+static size_t buddy_recursive_alloc(int zone, size_t order)
+{
+    if (order > BUDDY_MAX_ORDER)
         return -1;
+
+    /* Check if there is a free block in current order */
+    if (buddies[zone][order].free_list) {
+        struct vm_page *vm_page = buddies[zone][order].free_list;
+        size_t idx = buddy_page_idx(zone, order, vm_page);
+
+        buddy_list_remove(zone, order, vm_page);
+
+        /* Mark the bit as used */
+        bitmap_set(&buddies[zone][order].bitmap, idx);
+        buddies[zone][order].usable--;
+
+        return idx;
     } else {
         /* Search for a buddy in higher order to split */
         size_t idx = buddy_recursive_alloc(zone, order + 1);
@@ -76,11 +112,9 @@ static size_t buddy_recursive_alloc(int zone, size_t order)
 
         /* Mark it's buddy as free */
         bitmap_clear(&buddies[zone][order].bitmap, BUDDY_IDX(child_idx));
+        buddy_list_push(zone, order, BUDDY_IDX(child_idx));
         buddies[zone][order].usable++;
 
-        /* Shift first_free_idx to search after child_idx */
-        buddies[zone][order].first_free_idx = child_idx + 1;
-
         return child_idx;
     }
 }
@@ -96,27 +130,26 @@ static void buddy_recursive_free(int zone, size_t order, size_t idx)
     /* Check if buddy bit is free, then combine */
     if (order < BUDDY_MAX_ORDER && !bitmap_check(&buddies[zone][order].bitmap, BUDDY_IDX(idx))) {
         bitmap_set(&buddies[zone][order].bitmap, BUDDY_IDX(idx));
+        buddy_list_remove(zone, order, buddy_page(zone, order, BUDDY_IDX(idx)));
         buddies[zone][order].usable--;
 
         buddy_recursive_free(zone, order + 1, idx >> 1);
     } else {
         bitmap_clear(&buddies[zone][order].bitmap, idx);
+        buddy_list_push(zone, order, idx);
         buddies[zone][order].usable++;
-
-        /* Update first_free_idx */
-        if (buddies[zone][order].first_free_idx > idx)
-            buddies[zone][order].first_free_idx = idx;
     }
 }
 
 /** allocate new buddy
  * @param zone zone index
  * @param _sz chunk size
+ * @return physical address of the chunk or BUDDY_NONE on failure
  */
 paddr_t buddy_alloc(int zone, size_t _sz)
 {
     if (_sz > BUDDY_MAX_BS)
-        panic("Cannot allocate buddy");
+        return BUDDY_NONE;
 
     size_t sz = BUDDY_MIN_BS;
 
@@ -128,16 +161,14 @@ paddr_t buddy_alloc(int zone, size_t _sz)
         sz <<= 1;
     }
 
-    k_used_mem += sz;
-
     size_t idx = buddy_recursive_alloc(zone, order);
 
-    if (idx != (size_t) -1) {
-        return buddy_zone_offset[zone] + (uintptr_t) (idx * (BUDDY_MIN_BS << order));
-    } else {
-        panic("Cannot find free buddy");
-        //return (uintptr_t) NULL;
-    }
+    if (idx == (size_t) -1)
+        return BUDDY_NONE;
+
+    k_used_mem += sz;
+
+    return buddy_zone_offset[zone] + (uintptr_t) (idx * BUDDY_BS(order));
 }
 
 void buddy_free(int zone, paddr_t addr, size_t size)
@@ -184,14 +215,14 @@ void buddy_set_unusable(paddr_t addr, size_t size)
         if (end_idx > buddies[zone][BUDDY_MAX_ORDER].bitmap.max_idx)
             end_idx = buddies[zone][BUDDY_MAX_ORDER].bitmap.max_idx;
 
-        bitmap_set_range(&buddies[zone][BUDDY_MAX_ORDER].bitmap, start_idx, end_idx);
+        for (size_t idx = start_idx; idx <= end_idx; ++idx) {
+            if (bitmap_check(&buddies[zone][BUDDY_MAX_ORDER].bitmap, idx))
+                continue;
 
-        size_t ffidx = buddies[zone][BUDDY_MAX_ORDER].first_free_idx;
-
-        if (ffidx >= start_idx && ffidx <= end_idx)
-            buddies[zone][BUDDY_MAX_ORDER].first_free_idx = end_idx + 1;
-
-        buddies[zone][BUDDY_MAX_ORDER].usable -= (end_idx - start_idx + 1);
+            bitmap_set(&buddies[zone][BUDDY_MAX_ORDER].bitmap, idx);
+            buddy_list_remove(zone, BUDDY_MAX_ORDER, buddy_page(zone, BUDDY_MAX_ORDER, idx));
+            buddies[zone][BUDDY_MAX_ORDER].usable--;
+        }
 
         k_used_mem += size;
     }
@@ -225,12 +256,16 @@ int buddy_setup(size_t total_mem)
 
         /* Set the heighst order as free and the rest as unusable */
         bitmap_clear_range(&buddies[zone][BUDDY_MAX_ORDER].bitmap, 0, buddies[zone][BUDDY_MAX_ORDER].bitmap.max_idx);
-        buddies[zone][BUDDY_MAX_ORDER].first_free_idx = 0;
+        buddies[zone][BUDDY_MAX_ORDER].free_list = NULL;
         buddies[zone][BUDDY_MAX_ORDER].usable = buddies[zone][BUDDY_MAX_ORDER].bitmap.max_idx + 1;
 
+        /* Push in reverse so that lower blocks are handed out first */
+        for (size_t idx = buddies[zone][BUDDY_MAX_ORDER].usable; idx > 0; --idx)
+            buddy_list_push(zone, BUDDY_MAX_ORDER, idx - 1);
+
         for (int i = 0; i < BUDDY_MAX_ORDER; ++i) {
             bitmap_set_range(&buddies[zone][i].bitmap, 0, buddies[zone][i].bitmap.max_idx);
-            buddies[zone][i].first_free_idx = -1;
+            buddies[zone][i].free_list = NULL;
             buddies[zone][i].usable = 0;
         }
     }
@@ -19,7 +19,7 @@ struct pf {
     struct vm_entry *vm_entry;
 
     size_t off;
-    hash_t hash;
+    size_t idx;
 };
 
 static inline int check_violation(int flags, int vm_flags)
@@ -31,6 +31,80 @@ static inline int check_violation(int flags, int vm_flags)
     ((flags & PF_EXEC)  && !(vm_flags & VM_UX));
 }
 
+/*
+ * Private writable file mappings share the page cache page through an
+ * aref marked VM_COPY until the first write to it. The aref holds one
+ * reference to the cached page, every mapping of it another one.
+ *
+ * Untouched anonymous memory is handled the same way, read faults get
+ * a VM_COPY aref to the shared zero page.
+ */
+
+/**
+ * \ingroup mm
+ * \brief allocate a private copy of `vm_page` for the faulting page
+ */
+static struct vm_page *pf_page_copy(struct pf *pf, struct vm_page *vm_page)
+{
+    struct vm_page *new_page;
+
+    if (vm_page == mm_zero_page) {
+        /* nothing to copy */
+        if (!(new_page = mm_page_alloc_zero()))
+            return NULL;
+    } else {
+        if (!(new_page = mm_page_alloc(0)))
+            return NULL;
+
+        pmap_page_copy(vm_page->paddr, new_page->paddr);
+    }
+
+    new_page->off = pf->off;
+    new_page->ref = 1;
+    new_page->vm_object = NULL;
+
+    return new_page;
+}
+
+/**
+ * \ingroup mm
+ * \brief give an aref shared with the page cache (or the zero page)
+ * a private copy
+ */
+static int pf_aref_unshare(struct pf *pf, struct vm_aref *vm_aref)
+{
+    struct vm_page *vm_page = vm_aref->vm_page;
+    struct vm_page *new_page = pf_page_copy(pf, vm_page);
+
+    if (!new_page)
+        return -ENOMEM;
+
+    /* the aref's reference to the shared page */
+    mm_page_decref(vm_page->paddr);
+
+    vm_aref->vm_page = new_page;
+    vm_aref->flags &= ~VM_COPY;
+
+    return 0;
+}
+
+/**
+ * \ingroup mm
+ * \brief drop the reference a present mapping holds to a page cache
+ * page before the mapping gets replaced
+ */
+static void pf_mapping_drop(struct pf *pf)
+{
+    if (!(pf->flags & PF_PRESENT))
+        return;
+
+    paddr_t paddr = arch_page_get_mapping(pf->vm_space->pmap, pf->addr);
+    struct vm_page *vm_page = paddr? mm_page(paddr) : NULL;
+
+    if (vm_page && vm_page->vm_object)
+        mm_page_decref(paddr);
+}
+
 /**
  * \ingroup mm
  * \brief handle the page fault if the page is already present
@@ -52,27 +126,20 @@ static inline int pf_present(struct pf *pf)
         return 0;
 
     /* we own the anon */
-    struct hashmap_node *hash_node = hashmap_lookup(vm_anon->arefs, pf->hash, &pf->off);
-    struct vm_aref *vm_aref = (struct vm_aref *) (hash_node? hash_node->entry : NULL);
+    struct vm_aref *vm_aref = radix_tree_lookup(&vm_anon->arefs, pf->idx);
 
-    if (!vm_aref || vm_aref->ref != 1)
+    if (!vm_aref || vm_aref->ref != 1 || !vm_aref->vm_page)
         return 0;
 
     if (vm_aref->flags & VM_COPY) {
-        /* copy page */
-        struct vm_page *new_page = mm_page_alloc();
-        new_page->off = vm_aref->vm_page->off;
-        new_page->ref = 1;
-        new_page->vm_object = NULL;
-
-        pmap_page_copy(vm_aref->vm_page->paddr, new_page->paddr);
+        /* first write to a page shared with the page cache */
+        int err = pf_aref_unshare(pf, vm_aref);
 
-        mm_page_decref(vm_aref->vm_page->paddr);
+        if (err)
+            return err;
 
-        vm_aref->vm_page = new_page;
-        vm_aref->flags &= ~VM_COPY;
-
-        mm_page_map(pmap, pf->addr, new_page->paddr, pf->vm_entry->flags & VM_PERM);
+        pf_mapping_drop(pf);
+        mm_page_map(pmap, pf->addr, vm_aref->vm_page->paddr, pf->vm_entry->flags & VM_PERM);
     } else {
         /* we own the aref, just change permissions */
         pmap_protect(pmap, pf->addr, pf->addr+PAGE_SIZE, pf->vm_entry->flags & VM_PERM);
@@ -100,15 +167,18 @@ static inline int pf_anon(struct pf *pf)
         vm_anon->flags &= ~VM_COPY;
     }
 
-    struct hashmap_node *aref_node = hashmap_lookup(vm_anon->arefs, pf->hash, &pf->off);
+    struct vm_aref *aref = radix_tree_lookup(&vm_anon->arefs, pf->idx);
 
-    if (!aref_node || !aref_node->entry)
+    if (!aref)
         return 0;
 
-    struct vm_aref *aref = (struct vm_aref *) aref_node->entry;
+    if (!aref->vm_page) {
+        /* swapped out, read it back */
+        int err = swap_in(aref, pf->off);
 
-    if (!aref->vm_page)
-        panic("aref has no page");
+        if (err)
+            return err;
+    }
 
     if (!(pf->flags & PF_WRITE)) {
         /* map read-only */
@@ -126,6 +196,16 @@ static inline int pf_anon(struct pf *pf)
     if (aref->ref == 1) {
         /* we own the aref, just map */
 
+        if (aref->flags & VM_COPY) {
+            /* unless it is still shared with the page cache */
+            int err = pf_aref_unshare(pf, aref);
+
+            if (err)
+                return err;
+
+            pf_mapping_drop(pf);
+        }
+
         struct vm_page *vm_page = aref->vm_page;
 
         uint32_t perm = vm_entry->flags & VM_PERM;
@@ -140,43 +220,45 @@ static inline int pf_anon(struct pf *pf)
 
     struct vm_aref *new_aref = kmalloc(sizeof(struct vm_aref), &M_VM_AREF, M_ZERO);
 
-    if (!new_aref) {
-        /* TODO */
+    if (!new_aref)
+        return -ENOMEM;
+
+    struct vm_page *new_page = pf_page_copy(pf, aref->vm_page);
+
+    if (!new_page) {
+        kfree(new_aref);
+        return -ENOMEM;
     }
 
     new_aref->ref = 1;
-    new_aref->flags = aref->flags;
+    new_aref->flags = aref->flags & ~VM_COPY;
 
     aref->ref--;
 
-    struct vm_page *vm_page = aref->vm_page;
-
-    struct vm_page *new_page = mm_page_alloc();
-    new_page->off = vm_page->off;
-    new_page->ref = 1;
-    new_page->vm_object = NULL;
-
-    pmap_page_copy(vm_page->paddr, new_page->paddr);
-
     new_aref->vm_page = new_page;
 
-    hashmap_node_remove(vm_entry->vm_anon->arefs, aref_node);
-    hashmap_insert(vm_entry->vm_anon->arefs, pf->hash, new_aref);
+    radix_tree_replace(&vm_anon->arefs, pf->idx, new_aref);
 
+    pf_mapping_drop(pf);
     mm_page_map(pmap, pf->addr, new_page->paddr, vm_entry->flags & VM_PERM);
 
     return 1;
 }
 
-static inline struct vm_page *vm_object_page(struct vm_object *vm_object, hash_t hash, size_t off)
+static inline struct vm_page *vm_object_page(struct vm_object *vm_object, size_t off, uint32_t advice)
 {
-    struct hashmap_node *hash_node = hashmap_lookup(vm_object->pages, hash, &off);
-    struct vm_page *vm_page = NULL;
+    struct vm_page *vm_page = vm_object_page_get(vm_object, off);
 
-    if (hash_node) {
+    if (vm_page) {
         /* page was found in the vm object */
-        vm_page = (struct vm_page *) hash_node->entry;
+        vm_object_page_touch(vm_page);
     } else {
+        /* let madvise hints override the pager's read-ahead guess */
+        if (advice & VM_SEQUENTIAL)
+            vm_object->ra_next = PAGE_ALIGN(off);
+        else if (advice & VM_RANDOM)
+            vm_object->ra_next = (size_t) -1;
+
         /* page was not found, page in */
         if (vm_object->pager && vm_object->pager->in) {
             vm_page = vm_object->pager->in(vm_object, off);
@@ -189,6 +271,70 @@ static inline struct vm_page *vm_object_page(struct vm_object *vm_object, hash_t
     return vm_page;
 }
 
+/* pages around a faulting file page mapped in the same fault */
+#define FAULT_AROUND_NR 16
+
+/**
+ * \ingroup mm
+ * \brief map the already cached neighbours of a faulting object page
+ *
+ * Only used where object pages are mapped as they are (read-only and
+ * shared mappings), neighbours that are already mapped are skipped.
+ * Sequential regions only map the pages following the fault, random
+ * ones none at all.
+ */
+static void pf_object_around(struct pf *pf, uint32_t perm)
+{
+    struct vm_entry *vm_entry = pf->vm_entry;
+    struct vm_object *vm_object = vm_entry->vm_object;
+    struct pmap *pmap = pf->vm_space->pmap;
+
+    if (vm_entry->flags & VM_RANDOM)
+        return;
+
+    vaddr_t start = pf->addr & ~(FAULT_AROUND_NR * PAGE_SIZE - 1);
+
+    if (vm_entry->flags & VM_SEQUENTIAL)
+        start = pf->addr;
+
+    vaddr_t end = start + FAULT_AROUND_NR * PAGE_SIZE;
+
+    start = MAX(start, vm_entry->base);
+    end   = MIN(end, vm_entry->base + vm_entry->size);
+
+    size_t nr  = (end - start) / PAGE_SIZE;
+    size_t idx = VM_PAGE_IDX(start - vm_entry->base + vm_entry->off);
+
+    struct vm_page *cached[FAULT_AROUND_NR];
+
+    if (!radix_tree_gang_lookup(&vm_object->pages, idx, nr, (void **) cached))
+        return;
+
+    /* map runs of consecutive pages at once */
+    paddr_t run[FAULT_AROUND_NR];
+    size_t run_nr = 0;
+    vaddr_t run_va = 0;
+
+    for (size_t i = 0; i <= nr; ++i) {
+        vaddr_t va = start + i * PAGE_SIZE;
+        struct vm_page *vm_page = i < nr? cached[i] : NULL;
+
+        if (vm_page && va != pf->addr && !arch_page_get_mapping(pmap, va)) {
+            if (!run_nr)
+                run_va = va;
+
+            mm_page_incref(vm_page->paddr);
+            run[run_nr++] = vm_page->paddr;
+            continue;
+        }
+
+        if (run_nr) {
+            pmap_enter_range(pmap, run_va, run, run_nr, perm);
+            run_nr = 0;
+        }
+    }
+}
+
 static inline int pf_object(struct pf *pf)
 {
     struct vm_entry *vm_entry = pf->vm_entry;
@@ -197,13 +343,42 @@ static inline int pf_object(struct pf *pf)
     struct vm_page *vm_page = NULL;
     struct pmap *pmap = pf->vm_space->pmap;
 
-    /* look for page in the object pages hashmap */
-    vm_page = vm_object_page(vm_object, pf->hash, pf->off);
+    /* look for page in the object pages */
+    vm_page = vm_object_page(vm_object, pf->off, vm_entry->flags);
+
+    if (!vm_page)
+        return -ENOMEM;
 
     if (!(vm_entry->flags & VM_UW)) {
         /* read only page -- just map */
         mm_page_incref(vm_page->paddr);
         mm_page_map(pmap, pf->addr, vm_page->paddr, vm_entry->flags & VM_PERM);
+        pf_object_around(pf, vm_entry->flags & VM_PERM);
+        return 1;
+    }
+
+    if (vm_entry->flags & VM_SHARED) {
+        /* shared page -- map the cached page itself */
+        uint32_t perm = vm_entry->flags & VM_PERM;
+
+        if (pf->flags & PF_WRITE) {
+            /* written back to the object before the page is evicted */
+            vm_object_page_dirty(vm_page);
+        } else {
+            /* map read-only to catch the first write */
+            perm &= ~(VM_UW|VM_KW);
+        }
+
+        if (pf->flags & PF_PRESENT) {
+            pmap_protect(pmap, pf->addr, pf->addr+PAGE_SIZE, perm);
+        } else {
+            mm_page_incref(vm_page->paddr);
+            mm_page_map(pmap, pf->addr, vm_page->paddr, perm);
+
+            /* neighbours stay read-only until written to */
+            pf_object_around(pf, perm & ~(VM_UW|VM_KW));
+        }
+
         return 1;
     }
 
@@ -211,38 +386,67 @@ static inline int pf_object(struct pf *pf)
 
     /* allocate a new anon if we don't have one */
     if (!vm_entry->vm_anon) {
-        vm_entry->vm_anon = vm_anon_new();
+        if (!(vm_entry->vm_anon = vm_anon_new()))
+            return -ENOMEM;
+
         vm_entry->vm_anon->ref = 1;
     }
 
+    /* keep the page from being evicted while allocating the copy */
+    mm_page_incref(vm_page->paddr);
+
     struct vm_aref *vm_aref = kmalloc(sizeof(struct vm_aref), &M_VM_AREF, M_ZERO);
 
     if (!vm_aref) {
-        /* TODO */
+        mm_page_decref(vm_page->paddr);
+        return -ENOMEM;
     }
 
     vm_aref->vm_page = vm_page;
     vm_aref->ref = 1;
 
-    //if (!(pf->flags & PF_WRITE)) {
-    //    /* just mark for copying */
-    //    vm_aref->flags |= VM_COPY;
-    //    hashmap_insert(vm_entry->vm_anon->arefs, pf->hash, vm_aref);
-    //    uint32_t perms = (vm_entry->flags & VM_PERM) & ~(VM_UW|VM_KW);
-    //    mm_page_map(pmap, pf->addr, vm_page->paddr, perms);
-    //    return 1;
-    //}
+    if (!(pf->flags & PF_WRITE)) {
+        /* read fault -- share the cached page until the first write */
+        vm_aref->flags |= VM_COPY;
+
+        if (radix_tree_insert(&vm_entry->vm_anon->arefs, pf->idx, vm_aref)) {
+            mm_page_decref(vm_page->paddr);
+            kfree(vm_aref);
+            return -ENOMEM;
+        }
+
+        /* the aref keeps the reference taken above, one more for the mapping */
+        mm_page_incref(vm_page->paddr);
+
+        uint32_t perms = (vm_entry->flags & VM_PERM) & ~(VM_UW|VM_KW);
+        mm_page_map(pmap, pf->addr, vm_page->paddr, perms);
+
+        return 1;
+    }
 
     /* copy page */
-    struct vm_page *new_page = mm_page_alloc();
+    struct vm_page *new_page = mm_page_alloc(0);
+
+    if (!new_page) {
+        mm_page_decref(vm_page->paddr);
+        kfree(vm_aref);
+        return -ENOMEM;
+    }
+
     new_page->off = vm_page->off;
     new_page->ref = 1;
     new_page->vm_object = NULL;
 
     pmap_page_copy(vm_page->paddr, new_page->paddr);
+    mm_page_decref(vm_page->paddr);
 
     vm_aref->vm_page = new_page;
-    hashmap_insert(vm_entry->vm_anon->arefs, pf->hash, vm_aref);
+
+    if (radix_tree_insert(&vm_entry->vm_anon->arefs, pf->idx, vm_aref)) {
+        mm_page_dealloc(new_page->paddr);
+        kfree(vm_aref);
+        return -ENOMEM;
+    }
 
     mm_page_map(pmap, pf->addr, new_page->paddr, vm_entry->flags & VM_PERM);
 
@@ -256,16 +460,44 @@ static inline int pf_zero(struct pf *pf)
     struct pmap *pmap = pf->vm_space->pmap;
 
     if (!vm_entry->vm_anon) {
-        vm_entry->vm_anon = vm_anon_new();
+        if (!(vm_entry->vm_anon = vm_anon_new()))
+            return -ENOMEM;
+
         vm_entry->vm_anon->ref = 1;
     }
 
     struct vm_aref *vm_aref = kmalloc(sizeof(struct vm_aref), &M_VM_AREF, M_ZERO);
-    if (!vm_aref) {
-        /* TODO */
+
+    if (!vm_aref)
+        return -ENOMEM;
+
+    if (!(pf->flags & PF_WRITE)) {
+        /* read fault -- share the zero page until the first write */
+        vm_aref->vm_page = mm_zero_page;
+        vm_aref->ref = 1;
+        vm_aref->flags = VM_COPY;
+
+        if (radix_tree_insert(&vm_entry->vm_anon->arefs, pf->idx, vm_aref)) {
+            kfree(vm_aref);
+            return -ENOMEM;
+        }
+
+        /* the aref's reference */
+        mm_page_incref(mm_zero_page->paddr);
+
+        uint32_t perm = (vm_entry->flags & VM_PERM) & ~(VM_UW|VM_KW);
+        mm_page_map(pmap, pf->addr, mm_zero_page->paddr, perm);
+
+        return 1;
+    }
+
+    struct vm_page *new_page = mm_page_alloc_zero();
+
+    if (!new_page) {
+        kfree(vm_aref);
+        return -ENOMEM;
     }
 
-    struct vm_page *new_page = mm_page_alloc();
     new_page->off = pf->off;
     new_page->ref = 1;
     //new_page->vm_object = vm_object;
@@ -273,13 +505,225 @@ static inline int pf_zero(struct pf *pf)
     vm_aref->vm_page = new_page;
     vm_aref->ref = 1;
 
-    hashmap_insert(vm_entry->vm_anon->arefs, pf->hash, vm_aref);
+    if (radix_tree_insert(&vm_entry->vm_anon->arefs, pf->idx, vm_aref)) {
+        mm_page_dealloc(new_page->paddr);
+        kfree(vm_aref);
+        return -ENOMEM;
+    }
+
+    /* page is already zeroed */
+    mm_page_map(pmap, pf->addr, new_page->paddr, vm_entry->flags & VM_PERM);
 
-    mm_page_map(pmap, pf->addr, new_page->paddr, VM_KW); //vm_entry->flags & VM_PERM);
-    memset((void *) pf->addr, 0, PAGE_SIZE);
-    pmap_protect(pmap, pf->addr, pf->addr+PAGE_SIZE, vm_entry->flags & VM_PERM);
+    return 1;
+}
+
+/*
+ * large pages are only used for regions at least this many large pages
+ * long, a smaller region may well never touch most of the 4 MiB the
+ * first write would commit
+ */
+#define PF_LARGE_MIN_NR 4
+
+/**
+ * \ingroup mm
+ * \brief back an untouched, large page sized part of an anonymous
+ * region with a single large page
+ */
+static inline int pf_zero_large(struct pf *pf)
+{
+    struct vm_entry *vm_entry = pf->vm_entry;
+    struct pmap *pmap = pf->vm_space->pmap;
+
+    extern size_t k_total_mem, k_used_mem;
+    size_t large = pmap_large_size();
+
+    /* stacks are touched sparsely, don't commit a large page for them */
+    if (!large || (vm_entry->flags & VM_SHARED) || vm_entry == curproc->stack_vm)
+        return 0;
+
+    if (vm_entry->size < PF_LARGE_MIN_NR * large)
+        return 0;
+
+    /* reads are served by the zero page */
+    if (!(pf->flags & PF_WRITE))
+        return 0;
+
+    /* only while physical memory is plentiful */
+    if (k_total_mem - k_used_mem < k_total_mem / 8)
+        return 0;
+
+    /* would blow through a resident set limit at once */
+    if (curproc->rlimits[RLIMIT_RSS].rlim_cur != RLIM_INFINITY)
+        return 0;
+
+    vaddr_t base = pf->addr & ~(large - 1);
+
+    if (base < vm_entry->base || base + large > vm_entry->base + vm_entry->size)
+        return 0;
+
+    size_t nr = large / PAGE_SIZE, order = 0;
+    size_t off = pf->off - (pf->addr - base);
+    size_t idx = VM_PAGE_IDX(off);
+
+    while ((1UL << order) < nr)
+        ++order;
+
+    if (!vm_entry->vm_anon) {
+        /* fall back to small pages */
+        if (!(vm_entry->vm_anon = vm_anon_new()))
+            return 0;
+
+        vm_entry->vm_anon->ref = 1;
+    }
+
+    struct vm_anon *vm_anon = vm_entry->vm_anon;
+
+    /* every page in the range must still be untouched */
+    size_t next = idx;
+
+    if (radix_tree_next(&vm_anon->arefs, &next) && next < idx + nr)
+        return 0;
+
+    struct vm_page *vm_page = mm_page_alloc_order(order);
+
+    if (!vm_page)
+        return 0;
+
+    size_t i;
+    for (i = 0; i < nr; ++i) {
+        struct vm_aref *vm_aref = kmalloc(sizeof(struct vm_aref), &M_VM_AREF, M_ZERO);
+
+        if (!vm_aref)
+            goto error;
+
+        vm_page[i].off = off + i * PAGE_SIZE;
+        vm_page[i].ref = 1;
+
+        vm_aref->vm_page = &vm_page[i];
+        vm_aref->ref = 1;
+
+        if (radix_tree_insert(&vm_anon->arefs, idx + i, vm_aref)) {
+            kfree(vm_aref);
+            goto error;
+        }
+
+        pmap_page_zero(vm_page[i].paddr);
+    }
+
+    if (pmap_add(pmap, base, vm_page->paddr, large, vm_entry->flags & VM_PERM))
+        goto error;
 
     return 1;
+
+error:
+    /* undo, the range falls back to small pages */
+    while (i--)
+        kfree(radix_tree_delete(&vm_anon->arefs, idx + i));
+
+    for (i = 0; i < nr; ++i)
+        mm_page_dealloc(vm_page[i].paddr);
+
+    return 0;
+}
+
+/**
+ * \ingroup mm
+ * \brief make room for one more resident page of the current process
+ *
+ * Processes at their RLIMIT_RSS swap out their own pages first.
+ *
+ * \return 0 if the page may be mapped, -ENOMEM otherwise
+ */
+static int pf_rss_check(struct vm_space *vm_space)
+{
+    rlim_t limit = curproc->rlimits[RLIMIT_RSS].rlim_cur;
+
+    if (limit == RLIM_INFINITY || vm_space != &curproc->vm_space)
+        return 0;
+
+    size_t max = limit / PAGE_SIZE;
+    size_t resident = pmap_resident_count(vm_space->pmap);
+
+    if (resident < max)
+        return 0;
+
+    if (swap_vm_space(vm_space, resident - max + 1) < resident - max + 1)
+        return -ENOMEM;
+
+    return 0;
+}
+
+/* resolve a fault on `addr` inside `vm_entry`, > 0 when handled */
+static int pf_handle(struct vm_space *vm_space, struct vm_entry *vm_entry, vaddr_t addr, int flags)
+{
+    /* get page offset in object */
+    size_t off = addr - vm_entry->base + vm_entry->off;
+
+    /* construct page fault structure */
+    struct pf pf = {
+        .flags = flags,
+        .addr = addr,
+        .vm_space = vm_space,
+        .vm_entry = vm_entry,
+        .off = off,
+        .idx = VM_PAGE_IDX(off),
+    };
+
+    int ret = 0;
+
+    /* try to handle page present case */
+    if (flags & PF_PRESENT && (ret = pf_present(&pf)))
+        return ret;
+
+    /* check the anon layer for the page and handle if present */
+    if (vm_entry->vm_anon && (ret = pf_anon(&pf)))
+        return ret;
+
+    /* check the backening object for the page and handle if present */
+    if (vm_entry->vm_object && (ret = pf_object(&pf)))
+        return ret;
+
+    /* just zero out the page, a large one if the region allows */
+    if ((ret = pf_zero_large(&pf)))
+        return ret;
+
+    return pf_zero(&pf);
+}
+
+/**
+ * \ingroup mm
+ * \brief fault in the pages of `[sva, eva)` inside `vm_entry` ahead of use
+ *
+ * Pages are faulted in as they would be by the first access, private
+ * writable regions by a write. Pages already mapped are skipped.
+ */
+int mm_populate(struct vm_space *vm_space, struct vm_entry *vm_entry, vaddr_t sva, vaddr_t eva)
+{
+    int flags = PF_USER;
+
+    /* nothing can be touched */
+    if (!(vm_entry->flags & VM_UR))
+        return 0;
+
+    flags |= PF_READ;
+
+    if ((vm_entry->flags & VM_UW) && !(vm_entry->flags & VM_SHARED))
+        flags |= PF_WRITE;
+
+    for (vaddr_t va = PAGE_ALIGN(sva); va < eva; va += PAGE_SIZE) {
+        if (arch_page_get_mapping(vm_space->pmap, va))
+            continue;
+
+        int ret = pf_rss_check(vm_space);
+
+        if (!ret)
+            ret = pf_handle(vm_space, vm_entry, va, flags);
+
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
 }
 
 /**
@@ -297,7 +741,6 @@ void mm_page_fault(vaddr_t vaddr, int flags)
     vaddr_t addr = PAGE_ALIGN(vaddr);
 
     struct vm_space *vm_space = &curproc->vm_space;
-    struct pmap *pmap = vm_space->pmap;
     struct vm_entry *vm_entry = NULL;
 
     /* look for vm_entry that contains the page */
@@ -307,37 +750,47 @@ void mm_page_fault(vaddr_t vaddr, int flags)
     if (!vm_entry || check_violation(flags, vm_entry->flags))
         goto sigsegv;
 
-    /* get page offset in object */
-    size_t off = addr - vm_entry->base + vm_entry->off;
+    /* a new page must fit within the resident set limit */
+    if (!(flags & PF_PRESENT) && pf_rss_check(vm_space)) {
+        signal_proc_send(curproc, SIGKILL);
+        return;
+    }
 
-    /* hash the offset */
-    hash_t hash = hashmap_digest(&off, sizeof(off));
+    /*
+     * Faults from user mode come straight from the kernel boundary, no
+     * filesystem or heap update is in progress, so dirty cached pages
+     * may be written back and anonymous pages swapped out here. The
+     * faulting entry is left alone, its arefs are about to be used.
+     */
+    if (flags & PF_USER)
+        mm_reserve_fill(vm_entry);
 
-    /* construct page fault structure */
-    struct pf pf = {
-        .flags = flags,
-        .addr = addr,
-        .vm_space = vm_space,
-        .vm_entry = vm_entry,
-        .off = off,
-        .hash = hash,
-    };
+    int ret = pf_handle(vm_space, vm_entry, addr, flags);
 
-    /* try to handle page present case */
-    if (flags & PF_PRESENT && pf_present(&pf))
+    if (ret > 0)
         return;
 
-    /* check the anon layer for the page and handle if present */
-    if (vm_entry->vm_anon && pf_anon(&pf))
-        return;
+    if (ret == -ENOMEM && (flags & PF_USER) &&
+            (vm_object_reclaim(MM_BULK_NR, 1) || swap_reclaim(MM_BULK_NR, vm_entry))) {
+        if ((ret = pf_handle(vm_space, vm_entry, addr, flags)) > 0)
+            return;
+    }
 
-    /* check the backening object for the page and handle if present */
-    if (vm_entry->vm_object && pf_object(&pf))
-        return;
+    if (ret == -ENOMEM) {
+        /*
+         * Out of memory, kill the largest process. Its memory is only
+         * released once it gets to run and exit: a fault from user mode
+         * is simply taken again later, the kernel can't wait for it.
+         */
+        struct proc *victim = oom_kill();
 
-    /* just zero out the page */
-    if (pf_zero(&pf))
+        if (victim && victim != curproc && (flags & PF_USER))
+            return;
+
+        /* the faulting process can't continue */
+        signal_proc_send(curproc, SIGKILL);
         return;
+    }
 
 sigsegv:
     signal_proc_send(curproc, SIGSEGV);
@@ -7,6 +7,8 @@
 #include <mm/buddy.h> /* XXX */
 #include <mm/vm.h>
 
+#include <ds/bitmap.h>
+
 uintptr_t __stack_chk_guard = 0xDEADBEEF;
 void __stack_chk_fail(void)
 {
@@ -18,48 +20,399 @@ struct queue *malloc_types = QUEUE_NEW();
 MALLOC_DEFINE(M_BUFFER, "buffer", "generic buffer");
 MALLOC_DEFINE(M_RINGBUF, "ring-buffer", "ringbuffer structure");
 MALLOC_DEFINE(M_QUEUE, "queue", "queue structure");
-MALLOC_DEFINE(M_QNODE, "queue-node", "queue node structure");
+MALLOC_DEFINE_CACHE(M_QNODE, "queue-node", "queue node structure", sizeof(struct qnode), NULL);
 MALLOC_DEFINE(M_HASHMAP, "hashmap", "hashmap structure");
-MALLOC_DEFINE(M_HASHMAP_NODE, "hashmap-node", "hashmap node structure");
+MALLOC_DEFINE_CACHE(M_RADIX_NODE, "radix-node", "radix tree node structure", sizeof(struct radix_node), NULL);
 
 int debug_kmalloc = 0;
 
-struct kvmem_node {
-    uint32_t addr : 28; /* Offseting (1GiB), 4-bytes aligned objects */
-    uint32_t free : 1;  /* Free or not flag */
-    uint32_t size : 26; /* Size of one object can be up to 256MiB */
-    uint32_t next : 25; /* Index of the next node */
-    struct malloc_type *type;
-};
-
 size_t kvmem_used;
 size_t kvmem_obj_cnt;
 
 #define KVMEM_BASE       ARCH_KVMEM_BASE
 
-#define NODE_ADDR(node) (KVMEM_BASE + ((node).addr) * 4U)
-#define NODE_SIZE(node) (((node).size) * 4U)
-#define LAST_NODE_INDEX (100000)
-#define MAX_NODE_SIZE   ((1UL << 26) - 1)
+#define KVMEM_SLAB_BASE  ARCH_KVMEM_SLAB_BASE
+#define KVMEM_SLAB_SIZE  ARCH_KVMEM_SLAB_SIZE
+#define KVMEM_SLAB_NR    (KVMEM_SLAB_SIZE / PAGE_SIZE)
+
+/* heap ends where slabs begin */
+#define KVMEM_HEAP_END   KVMEM_SLAB_BASE
+#define KVMEM_HEAP_NR    ((KVMEM_HEAP_END - KVMEM_BASE) / PAGE_SIZE)
+
+/*
+ * Heap
+ *
+ * The heap is a contiguous run of blocks starting at KVMEM_BASE and ending
+ * with a zero sized used block at `kvmem_brk`, it is extended on demand.
+ * Every block starts with a header holding its size and flags, free blocks
+ * also carry free list links after the header and their size again at their
+ * last word, so both neighbours of a block are found in constant time.
+ *
+ * Free blocks are kept in segregated lists: the first level splits sizes by
+ * powers of two and the second level splits each power into KVMEM_SL_NR
+ * ranges. A bitmap per level tells which lists are non-empty, so finding a
+ * fitting block never walks the heap.
+ *
+ * Only pages backing used blocks and free block headers/footers are needed,
+ * pages in the interior of free blocks are given back to the buddy allocator.
+ */
+
+/**
+ * \ingroup mm
+ * \brief kvmem heap block
+ */
+struct kvmem_block {
+    /** block size including header, low bits hold flags */
+    size_t size;
+
+    /** type of the allocated object */
+    struct malloc_type *type;
 
-#if 0
-struct vm_entry kvmem_nodes = {
-    .base  = KVMEM_NODES,
-    .size  = KVMEM_NODES_SIZE,
-    .flags = VM_KRW,
+    /** links in the free list -- free blocks only */
+    struct kvmem_block *prev;
+    struct kvmem_block *next;
 };
-#endif
 
-//struct kvmem_node *nodes = (struct kvmem_node *) KVMEM_NODES;
-struct kvmem_node nodes[LAST_NODE_INDEX];
+#define BLOCK_FREE          0x1     /* block is free */
+#define BLOCK_PREV_FREE     0x2     /* previous block is free */
+#define BLOCK_FLAGS         (BLOCK_FREE | BLOCK_PREV_FREE)
+
+#define KVMEM_ALIGN         8
+#define BLOCK_HDR_SIZE      offsetof(struct kvmem_block, prev)
+#define BLOCK_MIN_SIZE      ((sizeof(struct kvmem_block) + sizeof(size_t) + KVMEM_ALIGN - 1) & ~(KVMEM_ALIGN - 1))
+
+#define BLOCK_SIZE(b)       ((b)->size & ~BLOCK_FLAGS)
+#define BLOCK_NEXT(b)       ((struct kvmem_block *) ((uintptr_t) (b) + BLOCK_SIZE(b)))
+#define BLOCK_PREV(b)       ((struct kvmem_block *) ((uintptr_t) (b) - *((size_t *) (b) - 1)))
+#define BLOCK_FOOTER(b)     ((size_t *) BLOCK_NEXT(b) - 1)
+#define BLOCK_OBJ(b)        ((void *) ((uintptr_t) (b) + BLOCK_HDR_SIZE))
+#define OBJ_BLOCK(obj)      ((struct kvmem_block *) ((uintptr_t) (obj) - BLOCK_HDR_SIZE))
+
+/* free lists geometry */
+#define KVMEM_SL_LOG2       3
+#define KVMEM_SL_NR         (1 << KVMEM_SL_LOG2)
+#define KVMEM_FL_SHIFT      (KVMEM_SL_LOG2 + 3)
+#define KVMEM_SMALL_BLOCK   (1 << KVMEM_FL_SHIFT)
+#define KVMEM_FL_NR         (8 * sizeof(size_t) - KVMEM_FL_SHIFT + 1)
+
+/* minimum heap extension */
+#define KVMEM_GROW_SIZE     (16 * PAGE_SIZE)
+
+/* freed pages kept mapped at most */
+#define KVMEM_RECLAIM_NR    256
+
+/* reclaim everything cached once free memory drops below this */
+#define KVMEM_LOW_WATERMARK(total)  ((total) / 64)
+
+static size_t kvmem_fl_bitmap;
+static uint32_t kvmem_sl_bitmap[KVMEM_FL_NR];
+static struct kvmem_block *kvmem_free_lists[KVMEM_FL_NR][KVMEM_SL_NR];
+
+static struct bitmap *heap_bitmap = BITMAP_NEW(KVMEM_HEAP_NR);
+static uintptr_t kvmem_brk = KVMEM_BASE;
+size_t kvmem_heap_pages = 0;
+
+static inline unsigned kvmem_fls(size_t x)
+{
+    return 8 * sizeof(unsigned long) - 1 - __builtin_clzl(x);
+}
+
+static inline void block_mapping(size_t size, unsigned *fl, unsigned *sl)
+{
+    if (size < KVMEM_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = size / (KVMEM_SMALL_BLOCK / KVMEM_SL_NR);
+    } else {
+        unsigned f = kvmem_fls(size);
+        *sl = (size >> (f - KVMEM_SL_LOG2)) ^ KVMEM_SL_NR;
+        *fl = f - KVMEM_FL_SHIFT + 1;
+    }
+}
+
+static void block_insert(struct kvmem_block *b)
+{
+    unsigned fl, sl;
+    block_mapping(BLOCK_SIZE(b), &fl, &sl);
+
+    b->prev = NULL;
+    b->next = kvmem_free_lists[fl][sl];
+
+    if (b->next)
+        b->next->prev = b;
+
+    kvmem_free_lists[fl][sl] = b;
+    kvmem_fl_bitmap     |= 1UL << fl;
+    kvmem_sl_bitmap[fl] |= 1U << sl;
+}
+
+static void block_remove(struct kvmem_block *b)
+{
+    unsigned fl, sl;
+    block_mapping(BLOCK_SIZE(b), &fl, &sl);
+
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        kvmem_free_lists[fl][sl] = b->next;
+
+    if (b->next)
+        b->next->prev = b->prev;
+
+    if (!kvmem_free_lists[fl][sl]) {
+        kvmem_sl_bitmap[fl] &= ~(1U << sl);
+
+        if (!kvmem_sl_bitmap[fl])
+            kvmem_fl_bitmap &= ~(1UL << fl);
+    }
+}
+
+/* find a free block of at least `size` bytes */
+static struct kvmem_block *block_find(size_t size)
+{
+    unsigned fl, sl;
+
+    /* round up to the next list, so that any block found there fits */
+    if (size >= KVMEM_SMALL_BLOCK)
+        size += (1UL << (kvmem_fls(size) - KVMEM_SL_LOG2)) - 1;
+
+    block_mapping(size, &fl, &sl);
+
+    if (fl >= KVMEM_FL_NR)
+        return NULL;
+
+    uint32_t sl_map = kvmem_sl_bitmap[fl] & (~0U << sl);
+
+    if (!sl_map) {
+        size_t fl_map = kvmem_fl_bitmap & (~0UL << (fl + 1));
+
+        if (!fl_map)
+            return NULL;
+
+        fl = __builtin_ctzl(fl_map);
+        sl_map = kvmem_sl_bitmap[fl];
+    }
+
+    sl = __builtin_ctz(sl_map);
+
+    return kvmem_free_lists[fl][sl];
+}
+
+/*
+ * Pages that end up in the interior of free blocks are not released right
+ * away, they stay mapped and are queued on a small reclaim ring, so that
+ * allocation/free churn reuses them without touching page tables. They are
+ * given back to the buddy allocator from the idle loop, when the ring
+ * overflows or when free memory drops below the low watermark.
+ */
+static struct bitmap *heap_cached = BITMAP_NEW(KVMEM_HEAP_NR);
+static vaddr_t reclaim_ring[KVMEM_RECLAIM_NR];
+static size_t reclaim_head = 0, reclaim_cnt = 0;
+
+size_t kvmem_cached_pages = 0;
+size_t kvmem_reclaimed_pages = 0;
+
+static inline int kvmem_low_memory(void)
+{
+    extern size_t k_total_mem, k_used_mem;
+    return k_total_mem - k_used_mem < KVMEM_LOW_WATERMARK(k_total_mem);
+}
+
+/* give back the oldest page on the reclaim ring, if still cached */
+static void kvmem_reclaim_one(void)
+{
+    vaddr_t vaddr = reclaim_ring[reclaim_head];
+    size_t idx = (vaddr - KVMEM_BASE) / PAGE_SIZE;
+
+    reclaim_head = (reclaim_head + 1) % KVMEM_RECLAIM_NR;
+    reclaim_cnt--;
+
+    /* page was reused since it got queued */
+    if (!bitmap_check(heap_cached, idx))
+        return;
+
+    paddr_t paddr = arch_page_get_mapping(kvm_space.pmap, vaddr);
+    pmap_remove(kvm_space.pmap, vaddr, vaddr + PAGE_SIZE);
+
+    if (paddr)
+        mm_page_dealloc(paddr);
+
+    bitmap_clear(heap_cached, idx);
+    bitmap_clear(heap_bitmap, idx);
+
+    kvmem_cached_pages--;
+    kvmem_heap_pages--;
+    kvmem_reclaimed_pages++;
+}
+
+/**
+ * \ingroup mm
+ * \brief return cached kvmem heap pages to the page allocator
+ *
+ * Releases cached pages, oldest first, until at most `keep` remain.
+ */
+void kvmem_reclaim(size_t keep)
+{
+    while (reclaim_cnt && kvmem_cached_pages > keep)
+        kvmem_reclaim_one();
+}
+
+/* back all pages touching [start, end) with memory */
+static int kvmem_map(uintptr_t start, uintptr_t end)
+{
+    size_t missing = 0;
+
+    for (vaddr_t vaddr = PAGE_ALIGN(start); vaddr < end; vaddr += PAGE_SIZE) {
+        size_t idx = (vaddr - KVMEM_BASE) / PAGE_SIZE;
+
+        if (!bitmap_check(heap_bitmap, idx)) {
+            missing++;
+            continue;
+        }
+
+        /* still mapped, just take it off the reclaim ring */
+        if (bitmap_check(heap_cached, idx)) {
+            bitmap_clear(heap_cached, idx);
+            kvmem_cached_pages--;
+        }
+    }
+
+    if (!missing)
+        return 0;
+
+    if (kvmem_low_memory())
+        kvmem_reclaim(0);
+
+    /* back the missing pages in batches */
+    struct vm_page *batch[MM_BULK_NR];
+    size_t batch_cnt = 0, batch_idx = 0;
+
+    for (vaddr_t vaddr = PAGE_ALIGN(start); vaddr < end; vaddr += PAGE_SIZE) {
+        size_t idx = (vaddr - KVMEM_BASE) / PAGE_SIZE;
+
+        if (bitmap_check(heap_bitmap, idx))
+            continue;
+
+        if (batch_idx == batch_cnt) {
+            batch_cnt = MIN(missing, MM_BULK_NR);
+            batch_idx = 0;
+
+            if (mm_page_alloc_bulk(batch_cnt, batch, MM_NORECLAIM))
+                return -ENOMEM;
+
+            missing -= batch_cnt;
+        }
+
+        struct vm_page *vm_page = batch[batch_idx++];
+
+        if (mm_page_map(kvm_space.pmap, vaddr, vm_page->paddr, VM_KRW)) {
+            mm_page_dealloc_bulk(batch_cnt - batch_idx + 1, batch + batch_idx - 1);
+            return -ENOMEM;
+        }
+
+        bitmap_set(heap_bitmap, idx);
+        kvmem_heap_pages++;
+    }
+
+    return 0;
+}
+
+/* queue all pages lying entirely within [start, end) for reclamation */
+static void kvmem_unmap(uintptr_t start, uintptr_t end)
+{
+    for (vaddr_t vaddr = PAGE_ROUND(start); vaddr + PAGE_SIZE <= end; vaddr += PAGE_SIZE) {
+        size_t idx = (vaddr - KVMEM_BASE) / PAGE_SIZE;
+
+        if (!bitmap_check(heap_bitmap, idx) || bitmap_check(heap_cached, idx))
+            continue;
+
+        if (reclaim_cnt == KVMEM_RECLAIM_NR)
+            kvmem_reclaim_one();
+
+        reclaim_ring[(reclaim_head + reclaim_cnt) % KVMEM_RECLAIM_NR] = vaddr;
+        reclaim_cnt++;
+
+        bitmap_set(heap_cached, idx);
+        kvmem_cached_pages++;
+    }
+
+    if (kvmem_low_memory())
+        kvmem_reclaim(0);
+}
+
+/* turn a used block into a free one, merging it with its free neighbours */
+static struct kvmem_block *block_release(struct kvmem_block *b)
+{
+    uintptr_t start = (uintptr_t) b;
+    uintptr_t end   = (uintptr_t) BLOCK_NEXT(b);
+    size_t size = BLOCK_SIZE(b);
+
+    struct kvmem_block *next = BLOCK_NEXT(b);
+
+    if (b->size & BLOCK_PREV_FREE) {
+        b = BLOCK_PREV(b);
+        block_remove(b);
+        size += BLOCK_SIZE(b);
+    }
+
+    if (next->size & BLOCK_FREE) {
+        block_remove(next);
+        size += BLOCK_SIZE(next);
+    }
+
+    b->size = size | BLOCK_FREE;
+    b->type = NULL;
+    *BLOCK_FOOTER(b) = size;
+    BLOCK_NEXT(b)->size |= BLOCK_PREV_FREE;
+
+    block_insert(b);
+
+    /* give back pages which are now in the interior of a free block,
+     * only the ones around the released range could have changed */
+    uintptr_t lo = MAX((uintptr_t) (b + 1), PAGE_ALIGN(start - sizeof(size_t)));
+    uintptr_t hi = MIN((uintptr_t) BLOCK_FOOTER(b), PAGE_ROUND(end + sizeof(struct kvmem_block)));
+
+    if (lo < hi)
+        kvmem_unmap(lo, hi);
+
+    return b;
+}
+
+/* extend the heap by at least `size` bytes, returns the last free block */
+static struct kvmem_block *kvmem_grow(size_t size)
+{
+    size = PAGE_ROUND(MAX(size, KVMEM_GROW_SIZE));
+
+    if (size > KVMEM_HEAP_END - kvmem_brk - BLOCK_HDR_SIZE)
+        return NULL;
+
+    /* the old end marker becomes the header of the new block */
+    struct kvmem_block *b = (struct kvmem_block *) kvmem_brk;
+    uintptr_t brk = kvmem_brk + size;
+
+    /* map free list links, new footer and end marker */
+    if (kvmem_map(kvmem_brk, (uintptr_t) (b + 1)) ||
+        kvmem_map(brk - sizeof(size_t), brk + BLOCK_HDR_SIZE))
+        return NULL;
+
+    struct kvmem_block *end = (struct kvmem_block *) brk;
+    end->size = 0;
+    end->type = NULL;
+
+    b->size = size | (b->size & BLOCK_PREV_FREE);
+    kvmem_brk = brk;
+
+    return block_release(b);
+}
 
 void kvmem_setup(void)
 {
-    /* Setting up initial node */
-    nodes[0].addr = 0;
-    nodes[0].free = 1;
-    nodes[0].size = -1;
-    nodes[0].next = LAST_NODE_INDEX;
+    /* Setting up the end marker of the empty heap */
+    if (kvmem_map(KVMEM_BASE, KVMEM_BASE + BLOCK_HDR_SIZE))
+        panic("kvmem: failed to setup heap");
+
+    struct kvmem_block *end = (struct kvmem_block *) KVMEM_BASE;
+    end->size = 0;
+    end->type = NULL;
 
     /* We have to set qnode to an arbitrary value since
      * enqueue will use kmalloc which would try to enqueue
@@ -70,231 +423,353 @@ void kvmem_setup(void)
     M_QNODE.qnode = enqueue(malloc_types, &M_QNODE);
 }
 
-uint32_t first_free_node = 0;
-static uint32_t get_node(void)
+/*
+ * Object caches
+ *
+ * Slabs are single pages taken from a dedicated virtual window right after
+ * the kvmem heap. The slab header lives at the start of the page, so the
+ * owning cache of any object is found by aligning the object address down.
+ */
+
+/**
+ * \ingroup mm
+ * \brief slab of objects belonging to a `kvmem_cache`
+ */
+struct kvmem_slab {
+    /** cache owning the slab */
+    struct kvmem_cache *cache;
+
+    /** links in the cache partial list */
+    struct kvmem_slab *prev;
+    struct kvmem_slab *next;
+
+    /** first free object */
+    void *free;
+
+    /** number of objects handed out */
+    size_t inuse;
+};
+
+#define SLAB_HDR_SIZE       ((sizeof(struct kvmem_slab) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+#define SLAB_OBJ(slab, i)   ((char *) (slab) + SLAB_HDR_SIZE + (i) * (slab)->cache->slot)
+#define SLAB_LINK(cache, obj) (*(void **) ((char *) (obj) + (cache)->slot - sizeof(void *)))
+
+/* largest object worth caching in single page slabs */
+#define SLAB_MAX_OBJ_SIZE   (PAGE_SIZE / 8)
+
+static struct bitmap *slab_bitmap = BITMAP_NEW(KVMEM_SLAB_NR);
+static size_t slab_ffidx = 0;
+size_t kvmem_slab_pages = 0;
+
+static struct kvmem_slab *slab_page_alloc(void)
 {
-    for (unsigned i = first_free_node; i < LAST_NODE_INDEX; ++i) {
-        if (!nodes[i].size) {
-            return i;
+    for (size_t i = slab_ffidx; i <= slab_bitmap->max_idx; ++i) {
+        if (!bitmap_check(slab_bitmap, i)) {
+            struct vm_page *vm_page = mm_page_alloc(MM_NORECLAIM);
+
+            if (!vm_page)
+                return NULL;
+
+            vaddr_t vaddr = KVMEM_SLAB_BASE + i * PAGE_SIZE;
+
+            if (mm_page_map(kvm_space.pmap, vaddr, vm_page->paddr, VM_KRW)) {
+                mm_page_dealloc(vm_page->paddr);
+                return NULL;
+            }
+
+            bitmap_set(slab_bitmap, i);
+            slab_ffidx = i + 1;
+            kvmem_slab_pages++;
+
+            return (struct kvmem_slab *) vaddr;
         }
     }
 
-    panic("Can't find an unused node");
+    return NULL;
 }
 
-void release_node(uint32_t i)
+static void slab_page_free(struct kvmem_slab *slab)
 {
-    if (nodes[i].type)
-        nodes[i].type->nr--;
+    vaddr_t vaddr = (vaddr_t) slab;
+    size_t idx = (vaddr - KVMEM_SLAB_BASE) / PAGE_SIZE;
+    paddr_t paddr = arch_page_get_mapping(kvm_space.pmap, vaddr);
+
+    pmap_remove(kvm_space.pmap, vaddr, vaddr + PAGE_SIZE);
+
+    if (paddr)
+        mm_page_dealloc(paddr);
 
-    memset(&nodes[i], 0, sizeof(struct kvmem_node));
-    nodes[i].free = 1;
+    bitmap_clear(slab_bitmap, idx);
+
+    if (idx < slab_ffidx)
+        slab_ffidx = idx;
+
+    kvmem_slab_pages--;
 }
 
-uint32_t get_first_fit_free_node(uint32_t size)
+static inline void slab_link(struct kvmem_slab **list, struct kvmem_slab *slab)
 {
-    unsigned i = first_free_node;
+    slab->prev = NULL;
+    slab->next = *list;
 
-    while (!(nodes[i].free && nodes[i].size >= size)) {
-        if (nodes[i].next == LAST_NODE_INDEX)
-            panic("Can't find a free node");
-        i = nodes[i].next;
-    }
+    if (*list)
+        (*list)->prev = slab;
 
-    return i;
+    *list = slab;
 }
 
-void print_node(unsigned i)
+static inline void slab_unlink(struct kvmem_slab **list, struct kvmem_slab *slab)
 {
-    printk("Node[%d]\n", i);
-    printk("   |_ Addr   : %x\n", NODE_ADDR(nodes[i]));
-    printk("   |_ free?  : %s\n", nodes[i].free?"yes":"no");
-    printk("   |_ Size   : %d B [ %d KiB ]\n",
-        NODE_SIZE(nodes[i]), NODE_SIZE(nodes[i])/1024);
-    printk("   |_ Next   : %d\n", nodes[i].next );
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+
+    if (slab->next)
+        slab->next->prev = slab->prev;
+
+    slab->prev = slab->next = NULL;
 }
 
-void *kmalloc(size_t size, struct malloc_type *type, int flags)
+static struct kvmem_slab *kvmem_slab_new(struct kvmem_cache *cache)
 {
-    /* round size to 4-byte units */
-    size = (size + 3)/4;
+    if (!cache->nr) {
+        /* first slab, compute cache geometry */
+        size_t size = MAX(cache->size, 1);
+        cache->slot = ((size + sizeof(void *) - 1) & ~(sizeof(void *) - 1)) + sizeof(void *);
+        cache->nr   = (PAGE_SIZE - SLAB_HDR_SIZE) / cache->slot;
+    }
 
-    /* Look for a first fit free node */
-    unsigned i = get_first_fit_free_node(size);
+    struct kvmem_slab *slab = slab_page_alloc();
 
-    /* Mark it as used */
-    nodes[i].free = 0;
+    if (!slab)
+        return NULL;
 
-    /* Split the node if necessary */
-    if (nodes[i].size > size) {
-        unsigned n = get_node();
+    slab->cache = cache;
+    slab->prev  = NULL;
+    slab->next  = NULL;
+    slab->inuse = 0;
+    slab->free  = SLAB_OBJ(slab, 0);
 
-        nodes[n].addr = nodes[i].addr + size;
-        nodes[n].free = 1;
-        nodes[n].size = nodes[i].size - size;
-        nodes[n].next = nodes[i].next;
+    for (size_t i = 0; i < cache->nr; ++i) {
+        void *obj = SLAB_OBJ(slab, i);
 
-        nodes[i].next = n;
-        nodes[i].size = size;
+        if (cache->ctor)
+            cache->ctor(obj);
+
+        SLAB_LINK(cache, obj) = i + 1 < cache->nr ? SLAB_OBJ(slab, i + 1) : NULL;
     }
 
-    nodes[i].type = type;
-    type->nr++;
+    cache->slabs_nr++;
 
-    type->total += NODE_SIZE(nodes[i]);
-    kvmem_used += NODE_SIZE(nodes[i]);
-    kvmem_obj_cnt++;
+    return slab;
+}
 
-    vaddr_t map_base = PAGE_ALIGN(NODE_ADDR(nodes[i]));
-    vaddr_t map_end  = PAGE_ROUND(NODE_ADDR(nodes[i]) + NODE_SIZE(nodes[i]));
-    size_t  map_size = (map_end - map_base)/PAGE_SIZE;
+static void kvmem_slab_destroy(struct kvmem_slab *slab)
+{
+    slab->cache->slabs_nr--;
+    slab_page_free(slab);
+}
 
-    if (map_size) {
-        struct vm_entry vm_entry;
+/**
+ * \ingroup mm
+ * \brief allocate an object from an object cache
+ */
+void *kvmem_cache_alloc(struct kvmem_cache *cache)
+{
+    struct kvmem_slab *slab = cache->partial;
 
-        vm_entry.paddr = 0,
-        vm_entry.base  = map_base,
-        vm_entry.size  = map_size * PAGE_SIZE,
-        vm_entry.flags = VM_KRW,
+    if (!slab) {
+        if ((slab = cache->empty))
+            cache->empty = NULL;
+        else if (!(slab = kvmem_slab_new(cache)))
+            return NULL;
 
-        vm_map(&kvm_space, &vm_entry);
+        slab_link(&cache->partial, slab);
     }
 
-    if (type->qnode == NULL) {
-        type->qnode = enqueue(malloc_types, type);
-    }
+    void *obj = slab->free;
+    slab->free = SLAB_LINK(cache, obj);
 
-    void *obj = (void *) NODE_ADDR(nodes[i]);
+    /* slab is full, drop it from the partial list */
+    if (++slab->inuse == cache->nr)
+        slab_unlink(&cache->partial, slab);
 
-    if (flags & M_ZERO) {
-        memset(obj, 0, size * 4);
-    }
+    cache->inuse++;
 
     return obj;
 }
 
-void kfree(void *_ptr)
+/**
+ * \ingroup mm
+ * \brief return an object to its object cache
+ */
+void kvmem_cache_free(struct kvmem_cache *cache, void *obj)
 {
-    //printk("kfree(%p)\n", _ptr);
-    uintptr_t ptr = (uintptr_t) _ptr;
+    struct kvmem_slab *slab = (struct kvmem_slab *) PAGE_ALIGN((uintptr_t) obj);
 
-    if (ptr < KVMEM_BASE)  /* That's not even allocatable */
-        return;
+    if (slab->cache != cache || ((uintptr_t) obj - (uintptr_t) SLAB_OBJ(slab, 0)) % cache->slot)
+        panic("kvmem: freeing an invalid cache object");
 
-    /* Look for the node containing _ptr -- merge sequential free nodes */
-    size_t cur_node = 0, prev_node = 0;
-
-    while (ptr != NODE_ADDR(nodes[cur_node])) {
-        /* check if current and previous node are free */
-        if (cur_node && nodes[cur_node].free && nodes[prev_node].free) {
-            /* check for overflow */
-            if ((uintptr_t) (nodes[cur_node].size + nodes[prev_node].size) <= MAX_NODE_SIZE) {
-                nodes[prev_node].size += nodes[cur_node].size;
-                nodes[prev_node].next  = nodes[cur_node].next;
-                release_node(cur_node);
-                cur_node = nodes[prev_node].next;
-                continue;
-            }
-        }
+    /* slab was full, make it available again */
+    if (slab->inuse-- == cache->nr)
+        slab_link(&cache->partial, slab);
 
-        prev_node = cur_node;
-        cur_node = nodes[cur_node].next;
+    SLAB_LINK(cache, obj) = slab->free;
+    slab->free = obj;
 
-        if (cur_node == LAST_NODE_INDEX)  /* Trying to free unallocated node */
-            goto done;
-    }
+    cache->inuse--;
 
-    if (nodes[cur_node].free)  { /* Node is already free, dangling pointer? */
-        printk("double free detected at %p\n", ptr);
-        if (nodes[cur_node].type)
-            printk("object type: %s\n", nodes[cur_node].type->name);
-        panic("double free");
-        //goto done;
-    }
+    if (!slab->inuse) {
+        slab_unlink(&cache->partial, slab);
 
-    /* First we mark our node as free */
-    nodes[cur_node].free = 1;
-    
-    if (nodes[cur_node].type) {
-        nodes[cur_node].type->total -= NODE_SIZE(nodes[cur_node]);
-        nodes[cur_node].type->nr--;
-        nodes[cur_node].type = NULL;
+        if (!cache->empty)
+            cache->empty = slab;
+        else
+            kvmem_slab_destroy(slab);
     }
+}
 
-    if (debug_kmalloc)
-        printk("NODE_SIZE %d\n", NODE_SIZE(nodes[cur_node]));
+static inline int kvmem_is_slab(uintptr_t ptr)
+{
+    return ptr >= KVMEM_SLAB_BASE && ptr - KVMEM_SLAB_BASE < KVMEM_SLAB_SIZE;
+}
 
-    kvmem_used -= NODE_SIZE(nodes[cur_node]);
-    kvmem_obj_cnt--;
+void *kmalloc(size_t size, struct malloc_type *type, int flags)
+{
+    struct kvmem_cache *cache = type->cache;
 
-    /* Now we merge all free nodes ahead -- except the last node */
-    while (nodes[cur_node].next < LAST_NODE_INDEX && nodes[cur_node].free) {
-        /* check if current and previous node are free */
-        if (cur_node && nodes[cur_node].free && nodes[prev_node].free) {
-            /* check for overflow */
-            if ((uintptr_t) (nodes[cur_node].size + nodes[prev_node].size) <= MAX_NODE_SIZE) {
-                nodes[prev_node].size += nodes[cur_node].size;
-                nodes[prev_node].next  = nodes[cur_node].next;
-                release_node(cur_node);
-                cur_node = nodes[prev_node].next;
-                continue;
-            }
+    if (cache && size <= cache->size && cache->size <= SLAB_MAX_OBJ_SIZE) {
+        void *obj = kvmem_cache_alloc(cache);
+
+        if (!obj)
+            return NULL;
+
+        type->nr++;
+        type->total += cache->size;
+        kvmem_used  += cache->size;
+        kvmem_obj_cnt++;
+
+        if (type->qnode == NULL) {
+            type->qnode = enqueue(malloc_types, type);
         }
 
-        prev_node = cur_node;
-        cur_node = nodes[cur_node].next;
+        if (flags & M_ZERO) {
+            memset(obj, 0, cache->size);
+        }
+
+        return obj;
     }
 
-    cur_node = 0;
-    while (nodes[cur_node].next < LAST_NODE_INDEX) {
-        if (nodes[cur_node].free) {
-            //struct vm_entry vm_entry = {0};
+    if (size > KVMEM_HEAP_END - KVMEM_BASE)
+        return NULL;
 
-            //vm_entry.paddr = 0;
-            //vm_entry.base  = NODE_ADDR(nodes[cur_node]);
-            //vm_entry.size  = NODE_SIZE(nodes[cur_node]);
-            //vm_entry.flags = VM_KRW;
+    size_t bsize = (size + BLOCK_HDR_SIZE + KVMEM_ALIGN - 1) & ~(KVMEM_ALIGN - 1);
+    bsize = MAX(bsize, BLOCK_MIN_SIZE);
 
-            vaddr_t vaddr = NODE_ADDR(nodes[cur_node]);
-            size_t  size  = NODE_SIZE(nodes[cur_node]);
+    struct kvmem_block *b = block_find(bsize);
 
-            //vm_unmap(&kvm_space, &vm_entry);
+    if (!b && !(b = kvmem_grow(bsize)))
+        return NULL;
 
-            /* XXX */
-            if (size < PAGE_SIZE) goto next;
+    block_remove(b);
 
-            vaddr_t sva = PAGE_ROUND(vaddr);
-            vaddr_t eva = PAGE_ALIGN(vaddr + size);
+    size_t total = BLOCK_SIZE(b);
 
-            size_t nr = (eva - sva)/PAGE_SIZE;
+    /* Split the block if the remainder is usable */
+    if (total - bsize >= BLOCK_MIN_SIZE) {
+        struct kvmem_block *rem = (struct kvmem_block *) ((uintptr_t) b + bsize);
 
-            while (nr--) {
-                paddr_t paddr = arch_page_get_mapping(kvm_space.pmap, sva);
+        if (kvmem_map((uintptr_t) rem, (uintptr_t) (rem + 1))) {
+            block_insert(b);
+            return NULL;
+        }
 
-                if (paddr) {
-                    pmap_remove(kvm_space.pmap, sva, sva + PAGE_SIZE);
-                    buddy_free(BUDDY_ZONE_NORMAL, paddr, PAGE_SIZE);
-                }
+        rem->size = (total - bsize) | BLOCK_FREE;
+        rem->type = NULL;
+        *BLOCK_FOOTER(rem) = total - bsize;
+        block_insert(rem);
 
-                sva += PAGE_SIZE;
-            }
-        }
+        b->size = bsize | (b->size & BLOCK_PREV_FREE);
+    } else {
+        BLOCK_NEXT(b)->size &= ~BLOCK_PREV_FREE;
+        b->size &= ~BLOCK_FREE;
+    }
+
+    if (kvmem_map((uintptr_t) b, (uintptr_t) BLOCK_NEXT(b))) {
+        block_release(b);
+        return NULL;
+    }
+
+    b->type = type;
+    type->nr++;
+
+    type->total += BLOCK_SIZE(b);
+    kvmem_used  += BLOCK_SIZE(b);
+    kvmem_obj_cnt++;
+
+    if (type->qnode == NULL) {
+        type->qnode = enqueue(malloc_types, type);
+    }
+
+    void *obj = BLOCK_OBJ(b);
 
-next:
-        cur_node = nodes[cur_node].next;
+    if (flags & M_ZERO) {
+        memset(obj, 0, size);
     }
 
-done:
-    return;
+    return obj;
 }
 
-void dump_nodes(void)
+void kfree(void *_ptr)
 {
-    printk("Nodes dump\n");
-    unsigned i = 0;
-    while (i < LAST_NODE_INDEX) {
-        print_node(i);
-        if (nodes[i].next == LAST_NODE_INDEX) break;
-        i = nodes[i].next;
+    //printk("kfree(%p)\n", _ptr);
+    uintptr_t ptr = (uintptr_t) _ptr;
+
+    if (kvmem_is_slab(ptr)) {
+        struct kvmem_slab *slab = (struct kvmem_slab *) PAGE_ALIGN(ptr);
+        struct kvmem_cache *cache = slab->cache;
+
+        kvmem_cache_free(cache, _ptr);
+
+        cache->type->nr--;
+        cache->type->total -= cache->size;
+        kvmem_used -= cache->size;
+        kvmem_obj_cnt--;
+
+        return;
+    }
+
+    if (ptr < KVMEM_BASE + BLOCK_HDR_SIZE || ptr >= kvmem_brk)  /* That's not even allocatable */
+        return;
+
+    if ((ptr - KVMEM_BASE - BLOCK_HDR_SIZE) % KVMEM_ALIGN) {
+        printk("kfree: invalid pointer %p\n", ptr);
+        panic("kfree: invalid pointer");
     }
+
+    struct kvmem_block *b = OBJ_BLOCK(ptr);
+
+    /* Header of a used block is always mapped and never cached, if it is
+     * not then it lies within a free block */
+    size_t idx = ((uintptr_t) b - KVMEM_BASE) / PAGE_SIZE;
+
+    if (!bitmap_check(heap_bitmap, idx) || bitmap_check(heap_cached, idx) ||
+        (b->size & BLOCK_FREE)) { /* Block is already free, dangling pointer? */
+        printk("double free detected at %p\n", ptr);
+        panic("double free");
+    }
+
+    if (b->type) {
+        b->type->total -= BLOCK_SIZE(b);
+        b->type->nr--;
+    }
+
+    if (debug_kmalloc)
+        printk("BLOCK_SIZE %d\n", BLOCK_SIZE(b));
+
+    kvmem_used -= BLOCK_SIZE(b);
+    kvmem_obj_cnt--;
+
+    block_release(b);
 }
@@ -20,9 +20,24 @@
 
 #include <sys/sched.h>
 
-/* FIXME use boot time allocation scheme */
-struct vm_page pages[768*1024];
-#define PAGE(addr)    (pages[(addr)/PAGE_SIZE])
+#include <core/kargs.h>
+
+/* page descriptors of all physical memory, allocated at boot */
+struct vm_page *pages = NULL;
+size_t pages_nr = 0;
+
+static inline struct vm_page *page_desc(paddr_t paddr)
+{
+    if (paddr / PAGE_SIZE >= pages_nr)
+        panic("mm: no page descriptor for physical address");
+
+    return &pages[paddr / PAGE_SIZE];
+}
+
+#define PAGE(addr)    (*page_desc(addr))
+
+/* device memory (e.g. framebuffers) mapped into user space has no descriptor */
+#define PAGE_VALID(addr)    ((addr) / PAGE_SIZE < pages_nr)
 
 /** 
  * \ingroup mm
@@ -30,7 +45,8 @@ struct vm_page pages[768*1024];
  */
 void mm_page_incref(paddr_t paddr)
 {
-    PAGE(paddr).ref++;
+    if (PAGE_VALID(paddr))
+        PAGE(paddr).ref++;
 }
 
 /**
@@ -39,7 +55,8 @@ void mm_page_incref(paddr_t paddr)
  */
 void mm_page_decref(paddr_t paddr)
 {
-    PAGE(paddr).ref--;
+    if (PAGE_VALID(paddr))
+        PAGE(paddr).ref--;
 }
 
 /**
@@ -48,26 +65,120 @@ void mm_page_decref(paddr_t paddr)
  */
 size_t mm_page_ref(paddr_t paddr)
 {
-    return PAGE(paddr).ref;
+    return PAGE_VALID(paddr)? PAGE(paddr).ref : 0;
 }
 
 /**
  * \ingroup mm
  * \brief get the virtual memory structure associated with a physical page
+ *
+ * \return NULL for memory without a descriptor (device memory)
  */
 struct vm_page *mm_page(paddr_t paddr)
 {
-    return &PAGE(paddr);
+    return PAGE_VALID(paddr)? &PAGE(paddr) : NULL;
+}
+
+/*
+ * Pre-zeroed pages
+ *
+ * Pages that must be handed out zero-filled are taken from a pool which
+ * is refilled while the CPU is idle, keeping the zeroing off the page
+ * fault path. Pool pages are linked through `vm_page->next`.
+ */
+static struct vm_page *zero_pool = NULL;
+size_t mm_zero_pool_cnt = 0;
+size_t mm_zero_pool_max = MM_ZERO_POOL_SIZE;
+size_t mm_zero_hits = 0, mm_zero_misses = 0;
+
+/*
+ * Shared zero page
+ *
+ * Read faults on untouched anonymous memory map this single page
+ * read-only, a private page is only allocated on the first write.
+ * It is never freed.
+ */
+struct vm_page *mm_zero_page = NULL;
+
+static struct vm_page *zero_pool_take(void)
+{
+    struct vm_page *vm_page = zero_pool;
+
+    if (vm_page) {
+        zero_pool = vm_page->next;
+        vm_page->next = NULL;
+        mm_zero_pool_cnt--;
+    }
+
+    return vm_page;
+}
+
+/*
+ * Reclaim
+ *
+ * Allocations that fail try to free memory by dropping clean pages
+ * from the page cache. Writing dirty pages back and swapping go through
+ * the filesystems, which allocate memory themselves, so they are never
+ * done from here: `mm_reserve_fill` does them from the page fault path.
+ *
+ * The kernel heap, slabs and page tables allocate with MM_NORECLAIM,
+ * the page cache (and its radix tree nodes) must not be touched while
+ * they are halfway through an update.
+ */
+
+/* free memory below which the page fault path writes back, drops and swaps pages */
+#define MM_RESERVE(total)   ((total) / 64)
+
+/* free up to `nr` clean pages from the page cache */
+static size_t mm_reclaim(size_t nr)
+{
+    return vm_object_reclaim(nr, 0);
+}
+
+/**
+ * \ingroup mm
+ * \brief free memory the slow way while it is low
+ *
+ * Writes back and drops cached pages, swaps anonymous pages out if
+ * that doesn't help. Keeps some memory around for MM_NORECLAIM
+ * allocations. Must only be called where I/O can't re-enter a
+ * filesystem or the heap mid-update.
+ *
+ * \param skip entry left alone by swap, the one being faulted on
+ */
+void mm_reserve_fill(struct vm_entry *skip)
+{
+    extern size_t k_total_mem, k_used_mem;
+
+    if (k_total_mem - k_used_mem >= MM_RESERVE(k_total_mem))
+        return;
+
+    if (!vm_object_reclaim(MM_BULK_NR, 1))
+        swap_reclaim(MM_BULK_NR, skip);
 }
 
 /**
  * \ingroup mm
  * \brief allocate an unused page from physical memory
+ *
+ * \param flags MM_NORECLAIM to fail rather than reclaim memory
+ * \return the page or `NULL` if out of memory
  */
-struct vm_page *mm_page_alloc(void)
+struct vm_page *mm_page_alloc(int flags)
 {
     /* Get new frame */
     paddr_t paddr = buddy_alloc(BUDDY_ZONE_NORMAL, PAGE_SIZE);
+
+    if (paddr == BUDDY_NONE) {
+        struct vm_page *vm_page = zero_pool_take();
+
+        if (vm_page || (flags & MM_NORECLAIM) || !mm_reclaim(MM_BULK_NR))
+            return vm_page;
+
+        if ((paddr = buddy_alloc(BUDDY_ZONE_NORMAL, PAGE_SIZE)) == BUDDY_NONE)
+            return NULL;
+    }
+
     struct vm_page *vm_page = &PAGE(paddr);
 
     memset(vm_page, 0, sizeof(struct vm_page));
@@ -90,6 +201,205 @@ void mm_page_dealloc(paddr_t paddr)
     //    buddy_free(BUDDY_ZONE_NORMAL, paddr, PAGE_SIZE);
 }
 
+/**
+ * \ingroup mm
+ * \brief allocate `nr` unused pages from physical memory
+ *
+ * Pages are taken in physically contiguous runs whenever possible,
+ * so that large requests cost a handful of buddy allocations.
+ *
+ * \param nr number of pages to allocate
+ * \param vm_pages array of at least `nr` entries receiving the pages
+ * \param flags MM_NORECLAIM to fail rather than reclaim memory
+ * \return 0 on success or -ENOMEM, in which case nothing is allocated
+ */
+int mm_page_alloc_bulk(size_t nr, struct vm_page **vm_pages, int flags)
+{
+    size_t i = 0, order = BUDDY_MAX_ORDER;
+    int reclaimed = 0;
+
+    while (i < nr) {
+        /* largest run that is still needed */
+        while (order && (1UL << order) > nr - i)
+            --order;
+
+        paddr_t paddr = buddy_alloc(BUDDY_ZONE_NORMAL, PAGE_SIZE << order);
+
+        if (paddr == BUDDY_NONE) {
+            /* no run this large, fall back to smaller ones */
+            if (!order) {
+                /* drop some of the page cache and retry once */
+                if (!(flags & MM_NORECLAIM) && !reclaimed++ && mm_reclaim(nr - i))
+                    continue;
+
+                goto error;
+            }
+
+            --order;
+            continue;
+        }
+
+        for (size_t j = 0; j < (1UL << order); ++j) {
+            struct vm_page *vm_page = &PAGE(paddr + j * PAGE_SIZE);
+
+            memset(vm_page, 0, sizeof(struct vm_page));
+            vm_page->paddr = paddr + j * PAGE_SIZE;
+
+            vm_pages[i++] = vm_page;
+        }
+    }
+
+    return 0;
+
+error:
+    mm_page_dealloc_bulk(i, vm_pages);
+    return -ENOMEM;
+}
+
+/**
+ * \ingroup mm
+ * \brief allocate `1 << order` physically contiguous pages
+ *
+ * The run is naturally aligned, so it can back a large page. Unlike
+ * single pages, no page cache is dropped to satisfy the request.
+ *
+ * \return the first page of the run or `NULL` if no such run is free
+ */
+struct vm_page *mm_page_alloc_order(size_t order)
+{
+    paddr_t paddr = buddy_alloc(BUDDY_ZONE_NORMAL, PAGE_SIZE << order);
+
+    if (paddr == BUDDY_NONE)
+        return NULL;
+
+    for (size_t j = 0; j < (1UL << order); ++j) {
+        struct vm_page *vm_page = &PAGE(paddr + j * PAGE_SIZE);
+
+        memset(vm_page, 0, sizeof(struct vm_page));
+        vm_page->paddr = paddr + j * PAGE_SIZE;
+    }
+
+    return &PAGE(paddr);
+}
+
+/**
+ * \ingroup mm
+ * \brief deallocate `nr` pages
+ *
+ * Physically contiguous runs in `vm_pages` are handed back to the buddy
+ * allocator as whole blocks.
+ */
+void mm_page_dealloc_bulk(size_t nr, struct vm_page **vm_pages)
+{
+    size_t i = 0;
+
+    while (i < nr) {
+        paddr_t paddr = vm_pages[i]->paddr;
+
+        /* length of the contiguous run starting at i */
+        size_t run = 1;
+        while (i + run < nr && vm_pages[i + run]->paddr == paddr + run * PAGE_SIZE)
+            ++run;
+
+        i += run;
+
+        while (run) {
+            /* largest aligned block at the head of the run */
+            size_t order = 0;
+            while (order < BUDDY_MAX_ORDER && (2UL << order) <= run &&
+                    !(paddr & ((PAGE_SIZE << (order + 1)) - 1)))
+                ++order;
+
+            buddy_free(BUDDY_ZONE_NORMAL, paddr, PAGE_SIZE << order);
+
+            paddr += PAGE_SIZE << order;
+            run   -= 1UL << order;
+        }
+    }
+}
+
+/**
+ * \ingroup mm
+ * \brief allocate a zero-filled page
+ *
+ * \return the page or `NULL` if out of memory
+ */
+struct vm_page *mm_page_alloc_zero(void)
+{
+    struct vm_page *vm_page = zero_pool_take();
+
+    if (vm_page) {
+        mm_zero_hits++;
+        return vm_page;
+    }
+
+    mm_zero_misses++;
+
+    if (!(vm_page = mm_page_alloc(0)))
+        return NULL;
+
+    pmap_page_zero(vm_page->paddr);
+
+    return vm_page;
+}
+
+/**
+ * \ingroup mm
+ * \brief setup pre-zeroed pages pool size from kernel arguments
+ * and allocate the shared zero page
+ */
+void mm_zero_pool_setup(void)
+{
+    const char *arg_size = NULL;
+
+    if (!(mm_zero_page = mm_page_alloc(0)))
+        panic("mm: could not allocate zero page");
+
+    pmap_page_zero(mm_zero_page->paddr);
+    mm_zero_page->ref = 1;
+
+    if (!kargs_get("mm.zeropool", &arg_size)) {
+        mm_zero_pool_max = 0;
+
+        for (const char *c = arg_size; *c >= '0' && *c <= '9'; ++c)
+            mm_zero_pool_max = mm_zero_pool_max * 10 + (*c - '0');
+    }
+
+    printk("mm: pre-zeroed pages pool size %d\n", mm_zero_pool_max);
+}
+
+/**
+ * \ingroup mm
+ * \brief refill the pre-zeroed pages pool, called when idle
+ */
+void mm_zero_pool_fill(void)
+{
+    extern size_t k_total_mem, k_used_mem;
+
+    if (mm_zero_pool_cnt >= mm_zero_pool_max)
+        return;
+
+    /* don't hold on to pages when memory is tight */
+    if (k_total_mem - k_used_mem < k_total_mem / 32)
+        return;
+
+    struct vm_page *batch[MM_BULK_NR];
+    size_t nr = MIN(mm_zero_pool_max - mm_zero_pool_cnt, MM_BULK_NR);
+
+    /* the pool is only topped up from memory that is really free */
+    if (mm_page_alloc_bulk(nr, batch, MM_NORECLAIM))
+        return;
+
+    for (size_t i = 0; i < nr; ++i) {
+        pmap_page_zero(batch[i]->paddr);
+
+        batch[i]->next = zero_pool;
+        zero_pool = batch[i];
+    }
+
+    mm_zero_pool_cnt += nr;
+}
+
 int mm_page_map(struct pmap *pmap, vaddr_t vaddr, paddr_t paddr, int flags)
 {
     /* TODO: Check out of bounds */
@@ -97,7 +407,7 @@ int mm_page_map(struct pmap *pmap, vaddr_t vaddr, paddr_t paddr, int flags)
     /* Increment references count to physical page */
     //mm_page_incref(paddr);
 
-    return pmap_add(pmap, vaddr, paddr, flags);
+    return pmap_add(pmap, vaddr, paddr, PAGE_SIZE, flags);
 }
 
 int mm_page_unmap(struct pmap *pmap, vaddr_t vaddr)
@@ -110,8 +420,9 @@ int mm_page_unmap(struct pmap *pmap, vaddr_t vaddr)
     paddr_t paddr = arch_page_get_mapping(pmap, vaddr);
 
     if (paddr) {
-        /* Decrement references count to physical page */
-        //mm_page_decref(paddr);
+        /* Drop the mapping's reference to page cache pages */
+        if (PAGE_VALID(paddr) && PAGE(paddr).vm_object)
+            mm_page_decref(paddr);
 
         /* Call arch specific page unmapper */
         pmap_remove(pmap, vaddr, vaddr + PAGE_SIZE);
@@ -138,25 +449,84 @@ int mm_map(struct pmap *pmap, paddr_t paddr, vaddr_t vaddr, size_t size, int fla
     paddr = PAGE_ALIGN(paddr);
 
     size_t nr = (endaddr - vaddr) / PAGE_SIZE;
+    size_t large = pmap_large_size();
+
+    /* pages are allocated in batches */
+    struct vm_page *batch[MM_BULK_NR];
+    size_t batch_cnt = 0, batch_idx = 0;
+
+    /* unmapped pages are entered into the pmap in runs */
+    paddr_t run[MM_BULK_NR];
+    vaddr_t run_va = vaddr;
+    size_t run_nr = 0;
+
+    while (nr) {
+        if (run_nr && (run_nr == MM_BULK_NR || run_va + run_nr * PAGE_SIZE != vaddr)) {
+            pmap_enter_range(pmap, run_va, run, run_nr, flags);
+            run_nr = 0;
+        }
+
+        /* physical ranges (e.g. framebuffers) use large pages where possible */
+        if (!alloc && large && nr >= large / PAGE_SIZE && !((vaddr | paddr) & (large - 1)) &&
+                !pmap_add(pmap, vaddr, paddr, large, flags)) {
+            vaddr += large;
+            paddr += large;
+            nr    -= large / PAGE_SIZE;
+            continue;
+        }
 
-    while (nr--) {
         paddr_t phys = arch_page_get_mapping(pmap, vaddr);
 
         if (!phys) {
             if (alloc) {
-                paddr = mm_page_alloc()->paddr;
+                if (batch_idx == batch_cnt) {
+                    batch_cnt = MIN(nr, MM_BULK_NR);
+                    batch_idx = 0;
+
+                    if (mm_page_alloc_bulk(batch_cnt, batch, 0)) {
+                        pmap_enter_range(pmap, run_va, run, run_nr, flags);
+                        return -ENOMEM;
+                    }
+                }
+
+                paddr = batch[batch_idx++]->paddr;
                 //printk("paddr = %p\n", paddr);
             }
-            mm_page_map(pmap, vaddr, paddr, flags);
+
+            if (!run_nr)
+                run_va = vaddr;
+
+            run[run_nr++] = paddr;
         }
 
         vaddr += PAGE_SIZE;
         paddr += PAGE_SIZE;
+        nr--;
     }
 
+    if (run_nr)
+        pmap_enter_range(pmap, run_va, run, run_nr, flags);
+
+    /* release what was left over from the last batch */
+    mm_page_dealloc_bulk(batch_cnt - batch_idx, batch + batch_idx);
+
     return 0;
 }
 
+/* drop the mappings of `sva` to `eva` with a single pmap operation */
+static void mm_unmap_range(struct pmap *pmap, vaddr_t sva, vaddr_t eva)
+{
+    /* Drop the mappings' references to page cache pages */
+    for (vaddr_t va = sva; va < eva; va += PAGE_SIZE) {
+        paddr_t paddr = arch_page_get_mapping(pmap, va);
+
+        if (paddr && PAGE_VALID(paddr) && PAGE(paddr).vm_object)
+            mm_page_decref(paddr);
+    }
+
+    pmap_remove(pmap, sva, eva);
+}
+
 void mm_unmap(struct pmap *pmap, vaddr_t vaddr, size_t size)
 {
     //printk("mm_unmap(pmap=%p, vaddr=%p, size=%ld)\n", pmap, vaddr, size);
@@ -167,16 +537,8 @@ void mm_unmap(struct pmap *pmap, vaddr_t vaddr, size_t size)
     vaddr_t sva = PAGE_ROUND(vaddr);
     vaddr_t eva = PAGE_ALIGN(vaddr + size);
 
-    //pmap_remove(pmap, sva, eva);
-
-#if 1
-    size_t nr = (eva - sva)/PAGE_SIZE;
-
-    while (nr--) {
-        mm_page_unmap(pmap, sva);
-        sva += PAGE_SIZE;
-    }
-#endif
+    if (sva < eva)
+        mm_unmap_range(pmap, sva, eva);
 }
 
 void mm_unmap_full(struct pmap *pmap, vaddr_t vaddr, size_t size)
@@ -188,19 +550,82 @@ void mm_unmap_full(struct pmap *pmap, vaddr_t vaddr, size_t size)
     vaddr_t start = PAGE_ALIGN(vaddr);
     vaddr_t end   = PAGE_ROUND(vaddr + size);
 
-    size_t nr = (end - start)/PAGE_SIZE;
+    if (start < end)
+        mm_unmap_range(pmap, start, end);
+}
+
+/* physical memory which must not be handed out while carving at boot */
+static paddr_t boot_used_end(struct boot *boot)
+{
+    extern char kernel_end;
+    paddr_t end = (paddr_t) &kernel_end;
+
+    for (int i = 0; i < boot->modules_count; ++i) {
+        module_t *mod = &boot->modules[i];
+        end = MAX(end, LMA((uintptr_t) mod->addr) + mod->size);
 
-    while (nr--) {
-        mm_page_unmap(pmap, start);
-        start += PAGE_SIZE;
+        if (mod->cmdline)
+            end = MAX(end, LMA((uintptr_t) mod->cmdline) + strlen(mod->cmdline) + 1);
     }
+
+    /* still needed by later boot stages */
+    if (boot->cmdline)
+        end = MAX(end, LMA((uintptr_t) boot->cmdline) + strlen(boot->cmdline) + 1);
+
+    if (boot->shdr)
+        end = MAX(end, LMA((uintptr_t) boot->shdr) + boot->shdr_num * sizeof(struct elf32_shdr));
+
+    if (boot->symtab)
+        end = MAX(end, LMA((uintptr_t) boot->symtab->sh_addr) + boot->symtab->sh_size);
+
+    if (boot->strtab)
+        end = MAX(end, LMA((uintptr_t) boot->strtab->sh_addr) + boot->strtab->sh_size);
+
+    return PAGE_ROUND(end);
+}
+
+/* take `size` bytes of usable physical memory above everything in use */
+static paddr_t boot_carve(struct boot *boot, paddr_t mem_end, size_t size)
+{
+    paddr_t start = boot_used_end(boot);
+
+    for (int i = 0; i < boot->mmap_count; ++i) {
+        mmap_t *mmap = &boot->mmap[i];
+
+        if (mmap->type != MMAP_USABLE)
+            continue;
+
+        paddr_t base = PAGE_ROUND(MAX(start, mmap->start));
+        paddr_t end  = MIN(mmap->end, mem_end);
+
+        if (base < end && end - base >= size)
+            return base;
+    }
+
+    panic("mm: no memory for page descriptors");
 }
 
 void mm_setup(struct boot *boot)
 {
     printk("kernel: total memory: %d KiB, %d MiB\n", boot->total_mem, boot->total_mem / 1024);
 
-    buddy_setup(boot->total_mem * 1024);
+    /* size page descriptors after physical memory, capped by their window */
+    uint64_t total_mem = (uint64_t) boot->total_mem * 1024;
+    total_mem = MIN(total_mem, (uint64_t) ARCH_VM_PAGES_SIZE / sizeof(struct vm_page) * PAGE_SIZE);
+    total_mem = MIN(total_mem, (paddr_t) -1 & ~PAGE_MASK);
+
+    pages_nr = total_mem / PAGE_SIZE;
+
+    size_t pages_size = PAGE_ROUND(pages_nr * sizeof(struct vm_page));
+    paddr_t pages_paddr = boot_carve(boot, total_mem, pages_size);
+
+    pages = arch_mm_pages_map(pages_paddr, pages_size);
+    memset(pages, 0, pages_nr * sizeof(struct vm_page));
+
+    printk("mm: %d page descriptors at %p (%d KiB)\n", pages_nr, pages_paddr, pages_size / 1024);
+
+    buddy_setup(total_mem);
+    buddy_set_unusable(pages_paddr, pages_size);
 
     /* Setup memory regions */
     for (int i = 0; i < boot->mmap_count; ++i) {
@@ -0,0 +1,78 @@
+/**
+ * \ingroup mm
+ * \brief out of memory killer
+ *
+ * Once neither the page cache nor swap can provide a page, the process
+ * with the largest resident set is sent SIGKILL. Its memory is released
+ * by exit once it gets to run, the victim may be asleep in the kernel
+ * using its address space at the time. No other process is killed
+ * until it is gone.
+ */
+
+#include <core/system.h>
+#include <core/printk.h>
+
+#include <mm/mm.h>
+#include <mm/pmap.h>
+#include <mm/vm.h>
+#include <sys/proc.h>
+#include <sys/sched.h>
+#include <sys/signal.h>
+
+/* pages charged to `proc` when looking for a victim */
+static size_t oom_badness(struct proc *proc)
+{
+    struct pmap *pmap = proc->vm_space.pmap;
+
+    /* init and exited processes are never picked */
+    if (proc->pid == 1 || !proc->threads.count || !pmap)
+        return 0;
+
+    return pmap_resident_count(pmap) + pmap_table_count(pmap);
+}
+
+/* last victim, until it exits */
+static struct proc *oom_victim = NULL;
+
+/**
+ * \ingroup mm
+ * \brief kill the process using the most memory
+ *
+ * Does not return if the current process is picked.
+ *
+ * \return the victim, a previous one still on its way out, or `NULL`
+ * if there is nothing to kill
+ */
+struct proc *oom_kill(void)
+{
+    struct proc *victim = NULL;
+    size_t worst = 0;
+
+    queue_for (node, procs) {
+        struct proc *proc = node->value;
+
+        if (proc == oom_victim && proc->threads.count)
+            return proc;
+    }
+
+    queue_for (node, procs) {
+        struct proc *proc = node->value;
+        size_t badness = oom_badness(proc);
+
+        if (badness > worst) {
+            victim = proc;
+            worst  = badness;
+        }
+    }
+
+    if (!victim)
+        return NULL;
+
+    printk("oom: killing process %d (%s), %d kB resident\n", victim->pid,
+            victim->name, pmap_resident_count(victim->vm_space.pmap) * PAGE_SIZE / 1024);
+
+    oom_victim = victim;
+    signal_proc_send(victim, SIGKILL);
+
+    return victim;
+}
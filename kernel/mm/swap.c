@@ -0,0 +1,343 @@
+/**
+ * \ingroup mm
+ * \brief swap
+ *
+ * When physical memory runs out and the page cache has nothing left to
+ * drop, private anonymous pages are written to a swap area (a block
+ * device or a regular file with a swap header, registered with `swapon`)
+ * and freed. The `vm_aref` keeps the swap slot instead of the page until
+ * the next fault on it reads the page back in.
+ *
+ * Only pages owned by a single mapping are swapped out, shared, locked
+ * and copy-on-write arefs are left alone. I/O is synchronous and may
+ * re-enter a filesystem and the heap, so swapping is only done from
+ * the page fault path before the fault is handled (never from within
+ * a page allocation).
+ */
+
+#include <core/system.h>
+#include <core/panic.h>
+#include <core/string.h>
+
+#include <mm/mm.h>
+#include <mm/vm.h>
+#include <fs/vfs.h>
+#include <fs/ioctl.h>
+#include <ds/bitmap.h>
+#include <ds/queue.h>
+#include <sys/proc.h>
+
+#include <bits/errno.h>
+
+MALLOC_DEFINE(M_SWAP, "swap", "swap slots bitmap");
+
+/*
+ * The first page of a swap area is its header, it ends with this magic
+ * (as written by mkswap). Slots are numbered from the page after it.
+ */
+#define SWAP_MAGIC      "SWAPSPACE2"
+#define SWAP_MAGIC_LEN  10
+
+/* offset of swap slot `slot` in the swap area */
+#define SWAP_OFF(slot)  ((off_t) ((slot) + 1) * PAGE_SIZE)
+
+/* swap area, one slot per page */
+static struct vnode *swap_vnode = NULL;
+static struct bitmap swap_slots = {0};
+
+/* next-fit: slot the next search starts from */
+static size_t swap_hint = 0;
+
+size_t swap_slots_nr = 0, swap_slots_used = 0;
+
+/* window used to access pages from the kernel */
+static char __swap_io[PAGE_SIZE] __aligned(PAGE_SIZE);
+
+static ssize_t swap_alloc(void)
+{
+    if (swap_slots_used == swap_slots_nr)
+        return -ENOSPC;
+
+    for (size_t i = 0; i < swap_slots_nr; ++i) {
+        size_t slot = (swap_hint + i) % swap_slots_nr;
+
+        if (!bitmap_check(&swap_slots, slot)) {
+            bitmap_set(&swap_slots, slot);
+            swap_slots_used++;
+            swap_hint = slot + 1;
+            return slot;
+        }
+    }
+
+    return -ENOSPC;
+}
+
+/**
+ * \ingroup mm
+ * \brief release swap slot `slot`
+ */
+void swap_free(size_t slot)
+{
+    if (slot >= swap_slots_nr || !bitmap_check(&swap_slots, slot))
+        panic("freeing an unused swap slot");
+
+    bitmap_clear(&swap_slots, slot);
+    swap_slots_used--;
+}
+
+/**
+ * \ingroup mm
+ * \brief read the page of a swapped out aref back into memory
+ *
+ * The swap slot is released once the page is read.
+ */
+int swap_in(struct vm_aref *vm_aref, size_t off)
+{
+    if (vm_aref->vm_page || !vm_aref->swap)
+        return -EINVAL;
+
+    size_t slot = vm_aref->swap - 1;
+    struct vm_page *vm_page = mm_page_alloc(0);
+
+    if (!vm_page)
+        return -ENOMEM;
+
+    mm_page_map(kvm_space.pmap, (vaddr_t) __swap_io, vm_page->paddr, VM_KRW);
+    ssize_t ret = vfs_read(swap_vnode, SWAP_OFF(slot), PAGE_SIZE, __swap_io);
+
+    if (ret != PAGE_SIZE) {
+        mm_page_dealloc(vm_page->paddr);
+        return ret < 0? ret : -EIO;
+    }
+
+    swap_free(slot);
+
+    vm_page->off = off;
+    vm_page->ref = 1;
+
+    vm_aref->vm_page = vm_page;
+    vm_aref->swap = 0;
+
+    return 0;
+}
+
+/* write the page of `vm_aref` mapped at `va` to swap and free it */
+static int swap_out(struct vm_space *vm_space, vaddr_t va, struct vm_aref *vm_aref)
+{
+    ssize_t slot = swap_alloc();
+
+    if (slot < 0)
+        return slot;
+
+    struct vm_page *vm_page = vm_aref->vm_page;
+
+    mm_page_map(kvm_space.pmap, (vaddr_t) __swap_io, vm_page->paddr, VM_KR);
+    ssize_t ret = vfs_write(swap_vnode, SWAP_OFF(slot), PAGE_SIZE, __swap_io);
+
+    if (ret != PAGE_SIZE) {
+        swap_free(slot);
+        return ret < 0? ret : -EIO;
+    }
+
+    mm_page_unmap(vm_space->pmap, va);
+    mm_page_dealloc(vm_page->paddr);
+
+    vm_aref->vm_page = NULL;
+    vm_aref->swap = slot + 1;
+
+    return 0;
+}
+
+/* swap out up to `nr` pages of `vm_entry`, returns the number of pages */
+static size_t swap_entry(struct vm_space *vm_space, struct vm_entry *vm_entry, size_t nr)
+{
+    struct vm_anon *vm_anon = vm_entry->vm_anon;
+
+    if (!vm_anon || vm_anon->ref != 1 || (vm_entry->flags & (VM_SHARED|VM_LOCKED)))
+        return 0;
+
+    size_t idx  = VM_PAGE_IDX(vm_entry->off);
+    size_t last = VM_PAGE_IDX(vm_entry->off + vm_entry->size);
+    size_t done = 0;
+
+    struct vm_aref *vm_aref;
+
+    for (; done < nr && (vm_aref = radix_tree_next(&vm_anon->arefs, &idx)) && idx < last; ++idx) {
+        /* the page must be private to this mapping */
+        if (vm_aref->ref != 1 || !vm_aref->vm_page || (vm_aref->flags & VM_COPY))
+            continue;
+
+        vaddr_t va = vm_entry->base + idx * PAGE_SIZE - vm_entry->off;
+
+        if (swap_out(vm_space, va, vm_aref))
+            break;
+
+        ++done;
+    }
+
+    return done;
+}
+
+/* swap I/O may allocate memory itself, which must not recurse into reclaim */
+static int swap_busy = 0;
+
+/* swap out up to `nr` pages of `vm_space` but `skip`, returns the number of pages */
+static size_t swap_space(struct vm_space *vm_space, size_t nr, struct vm_entry *skip)
+{
+    size_t done = 0;
+
+    vm_space_for (vm_entry, vm_space) {
+        if (vm_entry == skip)
+            continue;
+
+        done += swap_entry(vm_space, vm_entry, nr - done);
+
+        if (done == nr || swap_slots_used == swap_slots_nr)
+            break;
+    }
+
+    return done;
+}
+
+/**
+ * \ingroup mm
+ * \brief swap out up to `nr` anonymous pages of `vm_space` only
+ *
+ * Used to keep a process within its resident set limit, before the
+ * page that needs the room is faulted in.
+ */
+size_t swap_vm_space(struct vm_space *vm_space, size_t nr)
+{
+    if (!swap_vnode || swap_busy)
+        return 0;
+
+    swap_busy = 1;
+    size_t done = swap_space(vm_space, nr, NULL);
+    swap_busy = 0;
+
+    return done;
+}
+
+/* process the next reclaim pass starts at, so that no process is drained first */
+static size_t swap_clock = 0;
+
+/**
+ * \ingroup mm
+ * \brief swap out up to `nr` anonymous pages
+ *
+ * Called from the page fault path when no page could be reclaimed from
+ * the page cache, `skip` is the entry being faulted on. Returns the
+ * number of pages freed.
+ */
+size_t swap_reclaim(size_t nr, struct vm_entry *skip)
+{
+    if (!swap_vnode || swap_busy || !procs->count)
+        return 0;
+
+    swap_busy = 1;
+
+    size_t procs_nr = procs->count, done = 0;
+    size_t start = swap_clock++ % procs_nr;
+
+    for (size_t pass = 0; pass < 2 && done < nr; ++pass) {
+        size_t i = 0;
+
+        queue_for (node, procs) {
+            /* processes from `start` onwards first, then the rest */
+            if ((i++ < start) == !pass)
+                continue;
+
+            struct vm_space *vm_space = &((struct proc *) node->value)->vm_space;
+            done += swap_space(vm_space, nr - done, skip);
+
+            if (done == nr || swap_slots_used == swap_slots_nr)
+                goto out;
+        }
+    }
+
+out:
+    swap_busy = 0;
+
+    return done;
+}
+
+/* check that the first page of `vnode` is a swap header */
+static int swap_header_check(struct vnode *vnode)
+{
+    char *header = kmalloc(PAGE_SIZE, &M_SWAP, 0);
+
+    if (!header)
+        return -ENOMEM;
+
+    int err = 0;
+    ssize_t ret = vfs_read(vnode, 0, PAGE_SIZE, header);
+
+    if (ret != PAGE_SIZE)
+        err = ret < 0? ret : -EINVAL;
+    else if (strncmp(header + PAGE_SIZE - SWAP_MAGIC_LEN, SWAP_MAGIC, SWAP_MAGIC_LEN))
+        err = -EINVAL;
+
+    kfree(header);
+    return err;
+}
+
+/**
+ * \ingroup mm
+ * \brief use `vnode` (a block device or a regular file) as swap area
+ *
+ * The area must start with a swap header, so that a disk that merely
+ * happens to be attached is never overwritten. Only a single swap area
+ * is supported.
+ */
+int swap_on(struct vnode *vnode)
+{
+    if (swap_vnode)
+        return -EBUSY;
+
+    size_t size = 0;
+
+    if (S_ISBLK(vnode->mode)) {
+        unsigned long sectors = 0;
+        int err = vfs_ioctl(vnode, BLKGETSIZE, &sectors);
+
+        if (err)
+            return err;
+
+        size = sectors * 512;
+    } else if (S_ISREG(vnode->mode)) {
+        size = vnode->size;
+    } else {
+        return -EINVAL;
+    }
+
+    /* the header page is not a slot */
+    size_t slots_nr = size / PAGE_SIZE;
+
+    if (slots_nr < 2)
+        return -EINVAL;
+
+    slots_nr--;
+
+    int err = swap_header_check(vnode);
+
+    if (err)
+        return err;
+
+    bitmap_t *map = kmalloc(bitmap_size(slots_nr), &M_SWAP, M_ZERO);
+
+    if (!map)
+        return -ENOMEM;
+
+    swap_slots.map = map;
+    swap_slots.max_idx = slots_nr - 1;
+
+    swap_slots_nr = slots_nr;
+    swap_slots_used = 0;
+    swap_hint = 0;
+
+    swap_vnode = vnode;
+
+    printk("swap: %d kB on vnode %p\n", slots_nr * PAGE_SIZE / 1024, vnode);
+
+    return 0;
+}
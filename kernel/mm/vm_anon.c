@@ -4,22 +4,6 @@
 
 MALLOC_DEFINE(M_VM_ANON, "vm-anon", "anonymous virtual memory object");
 
-/**
- * \ingroup mm
- * \brief check if two arefs are equal in a hashmap
- */
-static int vm_aref_eq(void *_a, void *_b)
-{
-    struct vm_aref *a = (struct vm_aref *) _a;
-
-    if (!a->vm_page)
-        return -1;
-
-    size_t *b = (size_t *) _b;
-
-    return a->vm_page->off == *b;
-}
-
 /**
  * \ingroup mm
  * \brief create new anon structure
@@ -27,25 +11,13 @@ static int vm_aref_eq(void *_a, void *_b)
 struct vm_anon *vm_anon_new(void)
 {
     struct vm_anon *vm_anon = kmalloc(sizeof(struct vm_anon), &M_VM_ANON, M_ZERO);
-    if (!vm_anon) goto error;
-
-    vm_anon->arefs = hashmap_new(0, vm_aref_eq);
-
-    if (!vm_anon->arefs)
-        goto error;
-
-    return vm_anon;
-
-error:
-    //panic("failed to allocate vm_anon");
 
-    if (vm_anon) {
-        if (vm_anon->arefs)
-            hashmap_free(vm_anon->arefs);
-        kfree(vm_anon);
+    if (!vm_anon) {
+        //panic("failed to allocate vm_anon");
+        return NULL;
     }
 
-    return NULL;
+    return vm_anon;
 }
 
 /**
@@ -66,6 +38,34 @@ void vm_aref_decref(struct vm_aref *vm_aref)
     vm_aref->ref--;
 }
 
+/*
+ * drop an anon's reference to `aref`, once unused its private page is
+ * queued on `batch` (released when full)
+ */
+static void vm_aref_put(struct vm_aref *aref, struct vm_page **batch, size_t *batch_cnt)
+{
+    vm_aref_decref(aref);
+
+    if (aref->ref)
+        return;
+
+    if (aref->flags & VM_COPY) {
+        /* page cache or zero page, just drop the aref's reference */
+        mm_page_decref(aref->vm_page->paddr);
+    } else if (aref->vm_page) {
+        batch[(*batch_cnt)++] = aref->vm_page;
+
+        if (*batch_cnt == MM_BULK_NR) {
+            mm_page_dealloc_bulk(*batch_cnt, batch);
+            *batch_cnt = 0;
+        }
+    } else if (aref->swap) {
+        swap_free(aref->swap - 1);
+    }
+
+    kfree(aref);
+}
+
 /**
  * \ingroup mm
  * \brief destroy all resources associated with an anon
@@ -74,27 +74,43 @@ void vm_anon_destroy(struct vm_anon *vm_anon)
 {
     if (!vm_anon) return;
 
-    struct hashmap *arefs = vm_anon->arefs;
+    /* pages are released in batches */
+    struct vm_page *batch[MM_BULK_NR];
+    size_t batch_cnt = 0;
 
-    if (!arefs)
-        return;
+    struct vm_aref *aref;
 
-    hashmap_for (qnode, vm_anon->arefs) {
-        struct hashmap_node *hnode = (struct hashmap_node *) qnode->value;
-        struct vm_aref *aref = (struct vm_aref *) hnode->entry;
+    radix_tree_for (aref, idx, &vm_anon->arefs)
+        vm_aref_put(aref, batch, &batch_cnt);
 
-        vm_aref_decref(aref);
+    mm_page_dealloc_bulk(batch_cnt, batch);
 
-        if (!aref->ref) {
-            if (aref->vm_page) {
-                mm_page_dealloc(aref->vm_page->paddr);
-            }
+    radix_tree_free(&vm_anon->arefs);
+}
 
-            kfree(aref);
-        }
+/**
+ * \ingroup mm
+ * \brief release the arefs of `nr` pages starting at page index `idx`
+ *
+ * Used when part of a region is unmapped, the anon must not be shared.
+ */
+void vm_anon_release(struct vm_anon *vm_anon, size_t idx, size_t nr)
+{
+    if (!vm_anon || !nr)
+        return;
+
+    struct vm_page *batch[MM_BULK_NR];
+    size_t batch_cnt = 0;
+
+    struct vm_aref *aref;
+    size_t next = idx;
+
+    while ((aref = radix_tree_next(&vm_anon->arefs, &next)) && next - idx < nr) {
+        radix_tree_delete(&vm_anon->arefs, next);
+        vm_aref_put(aref, batch, &batch_cnt);
     }
 
-    hashmap_free(vm_anon->arefs);
+    mm_page_dealloc_bulk(batch_cnt, batch);
 }
 
 /**
@@ -133,15 +149,17 @@ void vm_anon_decref(struct vm_anon *vm_anon)
  */
 static int vm_anon_copy_arefs(struct vm_anon *src, struct vm_anon *dst)
 {
-    if (!src || !dst || !src->arefs || !dst->arefs)
+    if (!src || !dst)
         return -EINVAL;
 
+    struct vm_aref *aref;
+    int err;
+
     /* copy all arefs */
-    hashmap_for (qnode, src->arefs) {
-        struct hashmap_node *node = (struct hashmap_node *) qnode->value;
-        struct vm_aref *aref = (struct vm_aref *) node->entry;
+    radix_tree_for (aref, idx, &src->arefs) {
+        if ((err = radix_tree_insert(&dst->arefs, idx, aref)))
+            return err;
 
-        hashmap_insert(dst->arefs, node->hash, aref);
         aref->ref++;
     }
 
@@ -167,9 +185,50 @@ struct vm_anon *vm_anon_copy(struct vm_anon *vm_anon)
 
     /* copy all arefs */
     if (vm_anon_copy_arefs(vm_anon, new_anon)) {
+        /* drops the references taken so far */
+        vm_anon_destroy(new_anon);
         kfree(new_anon);
         return NULL;
     }
 
     return new_anon;
 }
+
+/**
+ * \ingroup mm
+ * \brief move the arefs from page index `idx` onwards to a new anon
+ *
+ * Used when splitting a vm entry, `vm_anon` is left untouched on failure.
+ */
+struct vm_anon *vm_anon_split(struct vm_anon *vm_anon, size_t idx)
+{
+    if (!vm_anon)
+        return NULL;
+
+    struct vm_anon *new_anon = vm_anon_new();
+
+    if (!new_anon)
+        return NULL;
+
+    new_anon->flags = vm_anon->flags;
+    new_anon->ref   = 1;
+
+    struct vm_aref *aref;
+    size_t next = idx;
+
+    for (; (aref = radix_tree_next(&vm_anon->arefs, &next)); ++next) {
+        if (radix_tree_insert(&new_anon->arefs, next, aref)) {
+            radix_tree_free(&new_anon->arefs);
+            kfree(new_anon);
+            return NULL;
+        }
+    }
+
+    /* only unlink once all of them made it */
+    next = idx;
+
+    while (radix_tree_next(&vm_anon->arefs, &next))
+        radix_tree_delete(&vm_anon->arefs, next);
+
+    return new_anon;
+}
@@ -3,11 +3,12 @@
 #include <core/panic.h>
 #include <mm/mm.h>
 #include <mm/vm.h>
-#include <ds/queue.h>
-#include <ds/hashmap.h>
+#include <ds/radix.h>
 
 MALLOC_DEFINE(M_VM_OBJECT, "vm-object", "virtual memory object");
 
+static void vm_object_destroy(struct vm_object *vm_object);
+
 void vm_object_incref(struct vm_object *vm_object)
 {
     vm_object->ref++;
@@ -16,19 +17,265 @@ void vm_object_incref(struct vm_object *vm_object)
 void vm_object_decref(struct vm_object *vm_object)
 {
     vm_object->ref--;
-    return;
 
-    /*
-    if (vm_object->ref == 0) {
-        hashmap_free(vm_object->pages);
+    /* file objects live as long as their vnode */
+    if (vm_object->ref == 0 && vm_object->type != VMOBJ_FILE) {
+        vm_object_destroy(vm_object);
         kfree(vm_object);
     }
-    */
 }
 
-void vm_object_page_insert(struct vm_object *vm_object, struct vm_page *vm_page)
+/*
+ * Page cache
+ *
+ * Pages owned by vm objects are kept on an LRU list linked through
+ * `vm_page->prev/next`, least recently used first. A cached page holds
+ * one reference for its object plus one per mapping, so pages with a
+ * single reference are not mapped anywhere and may be dropped (after
+ * being written back if dirty) when physical memory runs out.
+ *
+ * Dirty pages of objects without a pager `out` can't be dropped and
+ * are taken off the LRU (VM_PAGE_LRU clear) for good.
+ */
+static struct vm_page *lru_head = NULL, *lru_tail = NULL;
+size_t vm_cache_pages = 0, vm_cache_evicted = 0;
+
+static void lru_remove(struct vm_page *vm_page)
+{
+    if (!(vm_page->flags & VM_PAGE_LRU))
+        return;
+
+    if (vm_page->prev)
+        vm_page->prev->next = vm_page->next;
+    else
+        lru_head = vm_page->next;
+
+    if (vm_page->next)
+        vm_page->next->prev = vm_page->prev;
+    else
+        lru_tail = vm_page->prev;
+
+    vm_page->prev = vm_page->next = NULL;
+    vm_page->flags &= ~VM_PAGE_LRU;
+}
+
+static void lru_append(struct vm_page *vm_page)
+{
+    vm_page->flags |= VM_PAGE_LRU;
+    vm_page->prev = lru_tail;
+    vm_page->next = NULL;
+
+    if (lru_tail)
+        lru_tail->next = vm_page;
+    else
+        lru_head = vm_page;
+
+    lru_tail = vm_page;
+}
+
+int vm_object_page_insert(struct vm_object *vm_object, struct vm_page *vm_page)
+{
+    int err = radix_tree_insert(&vm_object->pages, VM_PAGE_IDX(vm_page->off), vm_page);
+
+    if (err)
+        return err;
+
+    lru_append(vm_page);
+    vm_cache_pages++;
+
+    return 0;
+}
+
+/**
+ * \ingroup mm
+ * \brief lookup the cached page at offset `off` of a vm object
+ */
+struct vm_page *vm_object_page_get(struct vm_object *vm_object, size_t off)
+{
+    return radix_tree_lookup(&vm_object->pages, VM_PAGE_IDX(off));
+}
+
+/**
+ * \ingroup mm
+ * \brief mark a cached page as recently used
+ */
+void vm_object_page_touch(struct vm_page *vm_page)
+{
+    if ((vm_page->flags & VM_PAGE_LRU) && vm_page != lru_tail) {
+        lru_remove(vm_page);
+        lru_append(vm_page);
+    }
+}
+
+/**
+ * \ingroup mm
+ * \brief mark a cached page as modified
+ *
+ * Pages that can't be written back are taken off the LRU, reclaim
+ * would only skip them over and over.
+ */
+void vm_object_page_dirty(struct vm_page *vm_page)
+{
+    struct vm_pager *pager = vm_page->vm_object->pager;
+
+    vm_page->flags |= VM_PAGE_DIRTY;
+
+    if (!pager || !pager->out)
+        lru_remove(vm_page);
+}
+
+static int vm_object_page_evict(struct vm_page *vm_page)
+{
+    struct vm_object *vm_object = vm_page->vm_object;
+    struct vm_pager *pager = vm_object->pager;
+
+    if (vm_page->flags & VM_PAGE_DIRTY) {
+        if (!pager || !pager->out)
+            return -EINVAL;
+
+        int err = pager->out(vm_object, vm_page->off);
+
+        if (err)
+            return err;
+    }
+
+    radix_tree_delete(&vm_object->pages, VM_PAGE_IDX(vm_page->off));
+
+    lru_remove(vm_page);
+    vm_cache_pages--;
+    vm_cache_evicted++;
+
+    mm_page_dealloc(vm_page->paddr);
+
+    return 0;
+}
+
+/*
+ * Shared anonymous memory
+ *
+ * Zero fill objects hold the pages of MAP_SHARED|MAP_ANONYMOUS regions
+ * so that they stay shared across fork, shmfs files use them as well.
+ * Pages are filled with zeros on first use and, having nowhere to be
+ * written back to, stay cached once dirty until the object goes away.
+ */
+static struct vm_page *zero_page_in(struct vm_object *vm_object, size_t off)
+{
+    struct vm_page *vm_page = mm_page_alloc_zero();
+
+    if (!vm_page)
+        return NULL;
+
+    vm_page->vm_object = vm_object;
+    vm_page->off = PAGE_ALIGN(off);
+    vm_page->ref = 1;
+
+    if (vm_object_page_insert(vm_object, vm_page)) {
+        mm_page_dealloc(vm_page->paddr);
+        return NULL;
+    }
+
+    return vm_page;
+}
+
+static struct vm_pager zero_pager = {
+    .in = zero_page_in,
+    .out = NULL,
+};
+
+/**
+ * \ingroup mm
+ * \brief create a new zero fill object for shared anonymous memory
+ */
+struct vm_object *vm_object_zero(void)
 {
-    size_t off = vm_page->off;
-    hash_t hash = hashmap_digest(&off, sizeof(off));
-    hashmap_insert(vm_object->pages, hash, vm_page);
+    struct vm_object *vm_object = kmalloc(sizeof(struct vm_object), &M_VM_OBJECT, M_ZERO);
+
+    if (!vm_object)
+        return NULL;
+
+    vm_object->type  = VMOBJ_ZERO;
+    vm_object->pager = &zero_pager;
+    vm_object->ref   = 1;
+
+    return vm_object;
+}
+
+/**
+ * \ingroup mm
+ * \brief drop the cached pages of an object from offset `off` onwards
+ *
+ * Pages that are still mapped are left alone.
+ */
+void vm_object_truncate(struct vm_object *vm_object, size_t off)
+{
+    struct vm_page *vm_page;
+    size_t idx = VM_PAGE_IDX(PAGE_ROUND(off));
+
+    for (; (vm_page = radix_tree_next(&vm_object->pages, &idx)); ++idx) {
+        if (vm_page->ref > 1)
+            continue;
+
+        radix_tree_delete(&vm_object->pages, idx);
+
+        lru_remove(vm_page);
+        vm_cache_pages--;
+
+        mm_page_dealloc(vm_page->paddr);
+    }
+}
+
+/* release all the cached pages of an object */
+static void vm_object_destroy(struct vm_object *vm_object)
+{
+    struct vm_page *vm_page;
+
+    radix_tree_for (vm_page, idx, &vm_object->pages) {
+        lru_remove(vm_page);
+        vm_cache_pages--;
+
+        mm_page_dealloc(vm_page->paddr);
+    }
+
+    radix_tree_free(&vm_object->pages);
+}
+
+/**
+ * \ingroup mm
+ * \brief drop up to `nr` unmapped pages from the page cache
+ *
+ * Pages still mapped somewhere are given a second chance and moved to
+ * the tail of the LRU, each page is looked at most once per call.
+ * Dirty pages are only written back and dropped if `writeback` is set,
+ * otherwise they are skipped as well.
+ *
+ * \return number of pages released
+ */
+size_t vm_object_reclaim(size_t nr, int writeback)
+{
+    static int reclaiming = 0;
+
+    /* writeback may allocate memory itself */
+    if (reclaiming)
+        return 0;
+
+    reclaiming = 1;
+
+    size_t released = 0, scan = vm_cache_pages;
+
+    while (released < nr && scan-- && lru_head) {
+        struct vm_page *vm_page = lru_head;
+
+        int skip = vm_page->ref > 1 || (!writeback && (vm_page->flags & VM_PAGE_DIRTY));
+
+        if (skip || vm_object_page_evict(vm_page)) {
+            vm_object_page_touch(vm_page);
+            continue;
+        }
+
+        released++;
+    }
+
+    reclaiming = 0;
+
+    return released;
 }
@@ -4,73 +4,476 @@
 #include <mm/pmap.h>
 #include <mm/vm.h>
 
-#include <ds/queue.h>
+#include <bits/mman.h>
+
+static void vm_entry_augment(struct rbnode *node)
+{
+    struct vm_entry *vm_entry = vm_entry_of(node);
+    size_t max_gap = vm_entry->gap;
+
+    if (node->left)
+        max_gap = MAX(max_gap, vm_entry_of(node->left)->max_gap);
+
+    if (node->right)
+        max_gap = MAX(max_gap, vm_entry_of(node->right)->max_gap);
+
+    vm_entry->max_gap = max_gap;
+}
+
+static inline uintptr_t vm_entry_end(struct vm_entry *vm_entry)
+{
+    return vm_entry? vm_entry->base + vm_entry->size : 0;
+}
+
+/* recompute the gap before `vm_entry` after its predecessor changed */
+static void vm_space_gap_update(struct vm_entry *vm_entry)
+{
+    if (!vm_entry)
+        return;
+
+    struct vm_entry *prev = vm_entry_of(rbtree_prev(&vm_entry->node));
+    vm_entry->gap = vm_entry->base - vm_entry_end(prev);
+    rbtree_propagate(&vm_entry->node, vm_entry_augment);
+}
+
+/* link `vm_entry` into the tree, ordered by base */
+static void vm_space_link(struct vm_space *vm_space, struct vm_entry *vm_entry)
+{
+    struct rbtree *tree = &vm_space->vm_entries;
+    struct rbnode **link = &tree->root, *parent = NULL;
+    struct vm_entry *prev = NULL, *next = NULL;
+
+    while (*link) {
+        struct vm_entry *cur = vm_entry_of(*link);
+        parent = *link;
+
+        if (vm_entry->base < cur->base) {
+            next = cur;
+            link = &parent->left;
+        } else {
+            prev = cur;
+            link = &parent->right;
+        }
+    }
+
+    vm_entry->gap = vm_entry->base - vm_entry_end(prev);
+    rbtree_insert(tree, &vm_entry->node, parent, link, vm_entry_augment);
+    vm_space_gap_update(next);
+}
+
+/*
+ * find the highest `align`ed base for a region of `size` bytes inside
+ * a gap of the subtree rooted at `node`, subtrees with no big enough
+ * gap are skipped.  returns 0 when there is none.
+ */
+static uintptr_t vm_space_gap_find(struct rbnode *node, size_t size, size_t align)
+{
+    if (!node)
+        return 0;
+
+    struct vm_entry *vm_entry = vm_entry_of(node);
+
+    if (vm_entry->max_gap < size)
+        return 0;
+
+    uintptr_t base;
+
+    if ((base = vm_space_gap_find(node->right, size, align)))
+        return base;
+
+    if (vm_entry->gap >= size) {
+        uintptr_t prev_end = vm_entry->base - vm_entry->gap;
+        base = (vm_entry->base - size) & ~(align - 1);
+
+        if (base && base >= prev_end)
+            return base;
+    }
+
+    return vm_space_gap_find(node->left, size, align);
+}
 
 /**
  * \ingroup mm
  * \brief insert a new vm entry into a vm space
+ *
+ * A zero `base` places the entry in the highest free gap below an
+ * existing entry, otherwise the range must not overlap any entry.
  */
 int vm_space_insert(struct vm_space *vm_space, struct vm_entry *vm_entry)
 {
     if (!vm_space || !vm_entry)
         return -EINVAL;
 
-    struct queue *queue = &vm_space->vm_entries;
+    if (!vm_entry->base) {
+        /* regions that can hold a large page are aligned to one */
+        size_t align = pmap_large_size();
 
-    int alloc = !vm_entry->base;
+        if (!align || vm_entry->size < align)
+            align = PAGE_SIZE;
 
-    uintptr_t end = vm_entry->base + vm_entry->size;
+        vm_entry->base = vm_space_gap_find(vm_space->vm_entries.root, vm_entry->size, align);
 
-    struct qnode *cur = NULL;
-    uintptr_t prev_end = 0;
+        if (!vm_entry->base)
+            return -ENOMEM;
+    } else {
+        uintptr_t end = vm_entry->base + vm_entry->size;
 
-    if (alloc) {
-        /* look for the last valid entry */
-        queue_for (node, queue) {
-            struct vm_entry *cur_vm_entry = (struct vm_entry *) node->value;
+        if (end < vm_entry->base)
+            return -EINVAL;
 
-            if (cur_vm_entry->base - prev_end >= vm_entry->size) {
-                vm_entry->base = cur_vm_entry->base - vm_entry->size;
-                end = vm_entry->base + vm_entry->size;
-            }
+        /* closest entries on both sides */
+        struct rbnode *node = vm_space->vm_entries.root;
+        struct vm_entry *prev = NULL, *next = NULL;
 
-            prev_end = cur_vm_entry->base + cur_vm_entry->size;
+        while (node) {
+            struct vm_entry *cur = vm_entry_of(node);
+
+            if (vm_entry->base < cur->base) {
+                next = cur;
+                node = node->left;
+            } else {
+                prev = cur;
+                node = node->right;
+            }
         }
+
+        if (vm_entry_end(prev) > vm_entry->base || (next && next->base < end))
+            return -ENOMEM;
     }
 
-    queue_for (node, queue) {
-        struct vm_entry *cur_vm_entry = (struct vm_entry *) node->value;
+    vm_space_link(vm_space, vm_entry);
+
+    return 0;
+}
+
+/**
+ * \ingroup mm
+ * \brief remove a vm entry from a vm space
+ *
+ * The entry is only unlinked, releasing its resources is up to the
+ * caller.
+ */
+void vm_space_remove(struct vm_space *vm_space, struct vm_entry *vm_entry)
+{
+    if (!vm_space || !vm_entry)
+        return;
+
+    struct vm_entry *next = vm_entry_of(rbtree_next(&vm_entry->node));
 
-        if (vm_entry->base && cur_vm_entry->base >= end && prev_end <= vm_entry->base) {
-            cur = node;
+    rbtree_erase(&vm_space->vm_entries, &vm_entry->node, vm_entry_augment);
+    vm_space_gap_update(next);
+
+    if (vm_space->last_hit == vm_entry)
+        vm_space->last_hit = NULL;
+}
+
+/**
+ * \ingroup mm
+ * \brief change the size of a vm entry in place
+ *
+ * Fails with -ENOMEM if the entry would run into the next one.
+ */
+int vm_space_resize(struct vm_space *vm_space, struct vm_entry *vm_entry, size_t size)
+{
+    if (!vm_space || !vm_entry)
+        return -EINVAL;
+
+    struct vm_entry *next = vm_entry_of(rbtree_next(&vm_entry->node));
+
+    if (vm_entry->base + size < vm_entry->base)
+        return -ENOMEM;
+
+    if (next && vm_entry->base + size > next->base)
+        return -ENOMEM;
+
+    vm_entry->size = size;
+    vm_space_gap_update(next);
+
+    return 0;
+}
+
+/* drop the mappings and private pages of `vm_entry` inside `[sva, eva)` */
+static int vm_entry_unmap_range(struct vm_space *vm_space, struct vm_entry *vm_entry,
+        vaddr_t sva, vaddr_t eva)
+{
+    struct vm_anon *vm_anon = vm_entry->vm_anon;
+
+    if (vm_anon && vm_anon->ref > 1) {
+        /* the pages stay with the other users, drop them from a private copy */
+        struct vm_anon *new_anon = vm_anon_copy(vm_anon);
+
+        if (!new_anon)
+            return -ENOMEM;
+
+        vm_anon_decref(vm_anon);
+        vm_entry->vm_anon = vm_anon = new_anon;
+    }
+
+    mm_unmap_full(vm_space->pmap, sva, eva - sva);
+
+    if (vm_anon) {
+        size_t idx = VM_PAGE_IDX(sva - vm_entry->base + vm_entry->off);
+        vm_anon_release(vm_anon, idx, (eva - sva) / PAGE_SIZE);
+    }
+
+    return 0;
+}
+
+/* most bytes one MADV_WILLNEED call reads in, the rest is left to faults */
+#define VM_WILLNEED_MAX (1024 * 1024)
+
+/*
+ * read the uncached file pages behind `[sva, eva)` into the page cache,
+ * a read-ahead window at a time
+ */
+static void vm_entry_willneed(struct vm_entry *vm_entry, vaddr_t sva, vaddr_t eva)
+{
+    struct vm_object *vm_object = vm_entry->vm_object;
+
+    if (vm_object->type != VMOBJ_FILE || !vm_object->pager || !vm_object->pager->in)
+        return;
+
+    struct vnode *vnode = (struct vnode *) vm_object->p;
+
+    size_t off = sva - vm_entry->base + vm_entry->off;
+    size_t end = MIN(eva - vm_entry->base + vm_entry->off, vnode->size);
+
+    /* the reads may sleep, meanwhile the entry may be unmapped */
+    vfs_vhold(vnode);
+
+    for (; off < end; off += PAGE_SIZE) {
+        if (vm_object_page_get(vm_object, off))
+            continue;
+
+        /* the pager reads ahead, the following pages come along */
+        if (!vm_object->pager->in(vm_object, off))
             break;
+    }
+
+    vfs_vrele(vnode);
+}
+
+/**
+ * \ingroup mm
+ * \brief split the vm entry containing `va` in two at `va`
+ *
+ * Does nothing if `va` is not strictly inside an entry. The private
+ * pages past `va` move to a new anon unless the anon is shared.
+ */
+int vm_space_split(struct vm_space *vm_space, vaddr_t va)
+{
+    struct vm_entry *vm_entry = vm_space_find(vm_space, va);
+
+    if (!vm_entry || va == vm_entry->base)
+        return 0;
+
+    struct vm_entry *tail = vm_entry_new();
+
+    if (!tail)
+        return -ENOMEM;
+
+    memcpy(tail, vm_entry, sizeof(struct vm_entry));
+    tail->base = va;
+    tail->size = vm_entry_end(vm_entry) - va;
+    tail->off += va - vm_entry->base;
+
+    if (vm_entry->vm_anon) {
+        if (vm_entry->vm_anon->ref == 1) {
+            tail->vm_anon = vm_anon_split(vm_entry->vm_anon, VM_PAGE_IDX(tail->off));
+
+            if (!tail->vm_anon) {
+                kfree(tail);
+                return -ENOMEM;
+            }
+        } else {
+            vm_anon_incref(tail->vm_anon);
+        }
+    }
+
+    if (tail->vm_object)
+        vm_object_incref(tail->vm_object);
+
+    vm_entry->size = va - vm_entry->base;
+    vm_space_link(vm_space, tail);
+
+    return 0;
+}
+
+/*
+ * split the entries crossing the ends of `[sva, eva)` and return the
+ * first entry inside it, the following ones are reached with
+ * `rbtree_next` while their base is below `eva`
+ */
+static struct vm_entry *vm_space_range(struct vm_space *vm_space, vaddr_t sva, vaddr_t eva, int *err)
+{
+    if ((*err = vm_space_split(vm_space, sva)) || (*err = vm_space_split(vm_space, eva)))
+        return NULL;
+
+    /* first entry ending after `sva` */
+    struct rbnode *node = vm_space->vm_entries.root;
+    struct vm_entry *vm_entry = NULL;
+
+    while (node) {
+        struct vm_entry *cur = vm_entry_of(node);
+
+        if (vm_entry_end(cur) > sva) {
+            vm_entry = cur;
+            node = node->left;
+        } else {
+            node = node->right;
         }
+    }
+
+    return vm_entry && vm_entry->base < eva? vm_entry : NULL;
+}
+
+/**
+ * \ingroup mm
+ * \brief unmap `[va, va + size)` from a vm space
+ *
+ * Entries crossing the ends of the range are split first, the entries
+ * inside it are removed.
+ */
+int vm_space_unmap(struct vm_space *vm_space, vaddr_t va, size_t size)
+{
+    if (!vm_space || (va & PAGE_MASK) || !size)
+        return -EINVAL;
+
+    vaddr_t sva = va, eva = PAGE_ROUND(va + size);
 
-        prev_end = cur_vm_entry->base + cur_vm_entry->size;
+    if (eva <= sva)
+        return -EINVAL;
+
+    int err;
+    struct vm_entry *vm_entry = vm_space_range(vm_space, sva, eva, &err);
+
+    while (vm_entry && vm_entry->base < eva) {
+        struct vm_entry *next = vm_entry_of(rbtree_next(&vm_entry->node));
+
+        vm_space_remove(vm_space, vm_entry);
+        vm_unmap_full(vm_space, vm_entry);
+        vm_entry_destroy(vm_entry);
+        kfree(vm_entry);
+
+        vm_entry = next;
     }
 
-    if (!cur)
-        return -ENOMEM;
+    return err;
+}
+
+/**
+ * \ingroup mm
+ * \brief apply `madvise` advice to `[va, va + size)`
+ *
+ * Access pattern advice is kept in the entry flags and steers the
+ * fault-around and read-ahead windows. MADV_WILLNEED reads uncached
+ * file pages in, up to VM_WILLNEED_MAX bytes from `va`, and
+ * MADV_DONTNEED drops the private pages, which read back as zeros (or
+ * file contents) afterwards.
+ */
+int vm_space_advise(struct vm_space *vm_space, vaddr_t va, size_t size, int advice)
+{
+    if (!vm_space || (va & PAGE_MASK) || !size)
+        return -EINVAL;
+
+    vaddr_t sva = va, eva = PAGE_ROUND(va + size);
+
+    if (eva <= sva)
+        return -EINVAL;
+
+    int err = 0;
+    struct vm_entry *vm_entry;
+
+    switch (advice) {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+        vm_entry = vm_space_range(vm_space, sva, eva, &err);
+
+        for (; vm_entry && vm_entry->base < eva; vm_entry = vm_entry_of(rbtree_next(&vm_entry->node))) {
+            vm_entry->flags &= ~(VM_RANDOM|VM_SEQUENTIAL);
+            vm_entry->flags |= advice == MADV_RANDOM? VM_RANDOM :
+                               advice == MADV_SEQUENTIAL? VM_SEQUENTIAL : 0;
+        }
+
+        return err;
 
-    struct qnode *node = kmalloc(sizeof(struct qnode), &M_QNODE, M_ZERO);
-    if (!node) {
-        /* TODO */
+    case MADV_WILLNEED:
+    case MADV_DONTNEED:
+        break;
+
+    default:
+        return -EINVAL;
     }
 
-    node->value = vm_entry;
-    node->next = cur;
-    node->prev = cur->prev;
+    /* these don't change the entries, no need to split them */
+    for (vaddr_t addr = sva; addr < eva; ) {
+        if (!(vm_entry = vm_space_find(vm_space, addr)))
+            return -ENOMEM;
+
+        vaddr_t end = MIN(vm_entry_end(vm_entry), eva);
 
-    if (cur->prev)
-        cur->prev->next = node;
+        if (advice == MADV_DONTNEED) {
+            if (vm_entry->flags & VM_LOCKED)
+                return -EINVAL;
 
-    cur->prev  = node;
-    vm_entry->qnode = node;
-    ++queue->count;
+            if ((err = vm_entry_unmap_range(vm_space, vm_entry, addr, end)))
+                return err;
+        } else if (vm_entry->vm_object && addr - sva < VM_WILLNEED_MAX) {
+            vm_entry_willneed(vm_entry, addr, MIN(end, sva + VM_WILLNEED_MAX));
+        }
+
+        addr = end;
+    }
 
     return 0;
 }
 
+/**
+ * \ingroup mm
+ * \brief lock (or unlock) the pages of `[va, va + size)` in memory
+ *
+ * Locking faults all the pages in, locked entries are left alone by
+ * page reclaim.
+ */
+int vm_space_lock(struct vm_space *vm_space, vaddr_t va, size_t size, int lock)
+{
+    if (!vm_space || !size)
+        return -EINVAL;
+
+    vaddr_t sva = PAGE_ALIGN(va), eva = PAGE_ROUND(va + size);
+
+    if (eva <= sva)
+        return -EINVAL;
+
+    /* the whole range must be mapped */
+    for (vaddr_t addr = sva; addr < eva; ) {
+        struct vm_entry *vm_entry = vm_space_find(vm_space, addr);
+
+        if (!vm_entry)
+            return -ENOMEM;
+
+        addr = vm_entry_end(vm_entry);
+    }
+
+    int err;
+    struct vm_entry *vm_entry = vm_space_range(vm_space, sva, eva, &err);
+
+    for (; vm_entry && vm_entry->base < eva; vm_entry = vm_entry_of(rbtree_next(&vm_entry->node))) {
+        if (!lock) {
+            vm_entry->flags &= ~VM_LOCKED;
+            continue;
+        }
+
+        if ((err = mm_populate(vm_space, vm_entry, vm_entry->base, vm_entry_end(vm_entry))))
+            return err;
+
+        vm_entry->flags |= VM_LOCKED;
+    }
+
+    return err;
+}
+
 /**
  * \ingroup mm
  * \brief lookup the vm entry containing `vaddr` inside a vm space
@@ -81,14 +484,25 @@ struct vm_entry *vm_space_find(struct vm_space *vm_space, vaddr_t vaddr)
 
     vaddr = PAGE_ALIGN(vaddr);
 
-    struct queue *vm_entries = &vm_space->vm_entries;
+    /* faults tend to hit the same region over and over */
+    struct vm_entry *vm_entry = vm_space->last_hit;
+
+    if (vm_entry && vaddr >= vm_entry->base && vaddr < vm_entry_end(vm_entry))
+        return vm_entry;
+
+    struct rbnode *node = vm_space->vm_entries.root;
 
-    queue_for (node, vm_entries) {
-        struct vm_entry *vm_entry = node->value;
-        vaddr_t vm_end = vm_entry->base + vm_entry->size;
+    while (node) {
+        vm_entry = vm_entry_of(node);
 
-        if (vaddr >= vm_entry->base && vaddr < vm_end)
+        if (vaddr < vm_entry->base) {
+            node = node->left;
+        } else if (vaddr >= vm_entry_end(vm_entry)) {
+            node = node->right;
+        } else {
+            vm_space->last_hit = vm_entry;
             return vm_entry;
+        }
     }
 
     return NULL;
@@ -103,19 +517,28 @@ void vm_space_destroy(struct vm_space *vm_space)
     if (!vm_space)
         return;
 
-    struct vm_entry *vm_entry = NULL;
+    struct rbnode *node = rbtree_first_postorder(&vm_space->vm_entries);
+
+    while (node) {
+        struct vm_entry *vm_entry = vm_entry_of(node);
+        node = rbtree_next_postorder(node);
 
-    while ((vm_entry = dequeue(&vm_space->vm_entries))) {
         vm_entry_destroy(vm_entry);
         kfree(vm_entry);
     }
 
+    vm_space->vm_entries.root  = NULL;
+    vm_space->vm_entries.count = 0;
+    vm_space->last_hit = NULL;
+
     pmap_remove_all(vm_space->pmap);
 }
 
 /**
  * \ingroup mm
  * \brief fork a vm space into another vm space
+ *
+ * \return 0 on success or -ENOMEM, in which case `dst` is left empty
  */
 int vm_space_fork(struct vm_space *src, struct vm_space *dst)
 {
@@ -123,16 +546,20 @@ int vm_space_fork(struct vm_space *src, struct vm_space *dst)
         return -EINVAL;
 
     /* copy vm entries */
-    queue_for (node, &src->vm_entries) {
-        struct vm_entry *s_entry = node->value;
+    vm_space_for (s_entry, src) {
         struct vm_entry *d_entry = kmalloc(sizeof(struct vm_entry), &M_VM_ENTRY, 0);
 
         if (!d_entry) {
-            /* TODO */
+            /* drop the references the entries copied so far hold */
+            vm_space_destroy(dst);
+            return -ENOMEM;
         }
 
         memcpy(d_entry, s_entry, sizeof(struct vm_entry));
-        d_entry->qnode = enqueue(&dst->vm_entries, d_entry);
+        vm_space_link(dst, d_entry);
+
+        /* memory locks are not inherited */
+        d_entry->flags &= ~VM_LOCKED;
 
         if (s_entry->vm_anon) {
             s_entry->vm_anon->flags |= VM_COPY;
@@ -6,7 +6,7 @@
 #include <ds/queue.h>
 #include <ds/hashmap.h>
 
-MALLOC_DEFINE(M_VM_AREF, "vm-aref", "anonymous virtual memory object reference");
+MALLOC_DEFINE_CACHE(M_VM_AREF, "vm-aref", "anonymous virtual memory object reference", sizeof(struct vm_aref), NULL);
 
 struct vm_space kvm_space;
 
@@ -20,21 +20,15 @@ void vm_unmap(struct vm_space *vm_space, struct vm_entry *vm_entry)
 {
     printk("vm_unmap(vm_space=%p, vm_entry=%p)\n", vm_space, vm_entry);
 
-    if (vm_entry->flags & VM_SHARED) {
-        /* TODO */
-    } else {
-        mm_unmap(vm_space->pmap, vm_entry->base, vm_entry->size);
-    }
+    /* unmapping never releases pages, shared ones are safe to drop too */
+    mm_unmap(vm_space->pmap, vm_entry->base, vm_entry->size);
 }
 
 void vm_unmap_full(struct vm_space *vm_space, struct vm_entry *vm_entry)
 {
     printk("vm_unmap(vm_space=%p, vm_entry=%p)\n", vm_space, vm_entry);
 
-    if (vm_entry->flags & VM_SHARED) {
-        /* TODO */
-    } else {
-        mm_unmap_full(vm_space->pmap, vm_entry->base, vm_entry->size);
-    }
+    /* unmapping never releases pages, shared ones are safe to drop too */
+    mm_unmap_full(vm_space->pmap, vm_entry->base, vm_entry->size);
 }
 
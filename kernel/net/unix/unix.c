@@ -7,7 +7,7 @@
 
 #define SOCKBUF 8192
 
-MALLOC_DEFINE(M_SOCKET, "socket", "socket struct");
+MALLOC_DEFINE_CACHE(M_SOCKET, "socket", "socket struct", sizeof(struct socket), NULL);
 MALLOC_DEFINE(M_UN_SOCKET, "unix socket", "unix socket struct");
 MALLOC_DEFINE(M_UN_CONN, "unix conn", "unix connection struct");
 
@@ -34,7 +34,9 @@ static int binfmt_fmt_load(struct proc *proc, const char *path, struct vnode *vn
     heap_vm->base  = proc->heap_start;
     heap_vm->size  = 0;
     heap_vm->flags = VM_URW;
-    heap_vm->qnode = enqueue(&proc->vm_space.vm_entries, heap_vm);
+
+    if ((err = vm_space_insert(&proc->vm_space, heap_vm)))
+        goto error;
 
     heap_vm->vm_object = NULL; //vm_object_anon();
     //vm_object_incref(heap_vm->vm_object);
@@ -50,7 +52,9 @@ static int binfmt_fmt_load(struct proc *proc, const char *path, struct vnode *vn
     stack_vm->base  = USER_STACK_BASE;
     stack_vm->size  = USER_STACK_SIZE;
     stack_vm->flags = VM_URW;
-    stack_vm->qnode = enqueue(&proc->vm_space.vm_entries, stack_vm);
+
+    if ((err = vm_space_insert(&proc->vm_space, stack_vm)))
+        goto error;
 
     stack_vm->vm_object = NULL; //vm_object_anon();
     //vm_object_incref(stack_vm->vm_object);
@@ -68,11 +68,6 @@ static int binfmt_elf32_load(struct proc *proc, struct vnode *vnode)
 
             /* TODO use W^X */
 
-            vm_entry->qnode = enqueue(&vm_space->vm_entries, vm_entry);
-
-            if (!vm_entry->qnode)
-                goto e_nomem;
-
             vm_entry->vm_object = vm_object_vnode(vnode);
 
             if (!vm_entry->vm_object)
@@ -83,6 +78,9 @@ static int binfmt_elf32_load(struct proc *proc, struct vnode *vnode)
 
             vm_object_incref(vm_entry->vm_object);
 
+            if ((err = vm_space_insert(vm_space, vm_entry)))
+                goto error;
+
             if (base + memsz > proc_heap)
                 proc_heap = base + memsz;
 
@@ -102,9 +100,10 @@ static int binfmt_elf32_load(struct proc *proc, struct vnode *vnode)
                     split->flags = vm_entry->flags;
                     split->off = 0;
 
-                    split->qnode = enqueue(&vm_space->vm_entries, split);
+                    vm_space_resize(vm_space, vm_entry, sz);
 
-                    vm_entry->size = sz;
+                    if ((err = vm_space_insert(vm_space, split)))
+                        goto error;
                 }
 
                 /* fault in the page */
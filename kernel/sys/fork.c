@@ -36,7 +36,7 @@ static int copy_fds(struct proc *parent, struct proc *fork)
 static int fork_proc_copy(struct proc *parent, struct proc *fork)
 {
     fork->pgrp = parent->pgrp;
-    fork->pgrp_node = enqueue(fork->pgrp->procs, fork);
+    queue_node_append(fork->pgrp->procs, &fork->pgrp_node, fork);
 
     fork->mask = parent->mask;
     fork->uid  = parent->uid;
@@ -47,6 +47,7 @@ static int fork_proc_copy(struct proc *parent, struct proc *fork)
     fork->entry = parent->entry;
 
     memcpy(fork->sigaction, parent->sigaction, sizeof(parent->sigaction));
+    memcpy(fork->rlimits, parent->rlimits, sizeof(parent->rlimits));
 
     return 0;
 }
@@ -108,12 +109,12 @@ int proc_fork(struct thread *thread, struct proc **ref)
         goto error;
 
     /* Fix heap & stack entry pointers -- XXX yes, we are doing this */
-    struct qnode *pvm_node = proc->vm_space.vm_entries.head;
-    struct qnode *fvm_node = fork->vm_space.vm_entries.head;
+    struct rbnode *pvm_node = rbtree_first(&proc->vm_space.vm_entries);
+    struct rbnode *fvm_node = rbtree_first(&fork->vm_space.vm_entries);
 
     while (pvm_node) {
-        struct vm_entry *pvm_entry = pvm_node->value;
-        struct vm_entry *fvm_entry = fvm_node->value;
+        struct vm_entry *pvm_entry = vm_entry_of(pvm_node);
+        struct vm_entry *fvm_entry = vm_entry_of(fvm_node);
 
         if (pvm_entry == proc->heap_vm)
             fork->heap_vm = fvm_entry;
@@ -121,8 +122,8 @@ int proc_fork(struct thread *thread, struct proc **ref)
         if (pvm_entry == proc->stack_vm)
             fork->stack_vm = fvm_entry;
 
-        pvm_node = pvm_node->next;
-        fvm_node = fvm_node->next;
+        pvm_node = rbtree_next(pvm_node);
+        fvm_node = rbtree_next(fvm_node);
     }
 
     /* Call arch specific fork handler */
@@ -100,8 +100,12 @@ int proc_new(struct proc **ref)
     for (int i = 0; i < SIG_MAX; ++i)
         proc->sigaction[i].sa_handler = SIG_DFL;
 
+    /* No resource limits */
+    for (int i = 0; i < RLIMIT_NLIMITS; ++i)
+        proc->rlimits[i] = (struct rlimit) {RLIM_INFINITY, RLIM_INFINITY};
+
     proc->running = 1;
-    enqueue(procs, proc);   /* Add process to all processes queue */
+    queue_node_append(procs, &proc->procs_node, proc);   /* Add process to all processes queue */
 
     if (ref)
         *ref = proc;
@@ -179,13 +183,15 @@ void proc_kill(struct proc *proc)
 
     /* Kill all threads */
     while (proc->threads.count) {
-        struct thread *thread = dequeue(&proc->threads);
+        struct thread *thread = queue_node_pop(&proc->threads);
+
+        if (thread->sleep_queue) /* Thread is sleeping on some queue */
+            queue_node_unlink(thread->sleep_queue, &thread->sleep_node);
 
-        if (thread->sleep_node) /* Thread is sleeping on some queue */
-            queue_node_remove(thread->sleep_queue, thread->sleep_node);
+        if (thread->sched_queue) /* Thread is in the scheduler queue */
+            queue_node_unlink(thread->sched_queue, &thread->sched_node);
 
-        if (thread->sched_node) /* Thread is in the scheduler queue */
-            queue_node_remove(thread->sched_queue, thread->sched_node);
+        thread->sleep_queue = thread->sched_queue = NULL;
 
         if (thread == curthread) {
             kill_curthread = 1;
@@ -229,7 +235,7 @@ void proc_kill(struct proc *proc)
     kfree(proc->name);
 
     /* XXX */
-    queue_node_remove(proc->pgrp->procs, proc->pgrp_node);
+    queue_node_unlink(proc->pgrp->procs, &proc->pgrp_node);
 
     /* Wakeup parent if it is waiting for children */
     if (proc->parent) {
@@ -250,12 +256,33 @@ int proc_reap(struct proc *proc)
 {
     proc_pid_free(proc->pid);
 
-    queue_remove(procs, proc);
+    queue_node_unlink(procs, &proc->procs_node);
     kfree(proc);
 
     return 0;
 }
 
+/**
+ * \ingroup sys
+ * \brief check if the address space of `proc` may grow by `size` bytes
+ *
+ * \return 0 if allowed, -ENOMEM if it would exceed RLIMIT_AS
+ */
+int proc_as_check(struct proc *proc, size_t size)
+{
+    rlim_t limit = proc->rlimits[RLIMIT_AS].rlim_cur;
+
+    if (limit == RLIM_INFINITY)
+        return 0;
+
+    size_t total = size;
+
+    vm_space_for (vm_entry, &proc->vm_space)
+        total += vm_entry->size;
+
+    return total > limit? -ENOMEM : 0;
+}
+
 int proc_fd_get(struct proc *proc)
 {
     for (int i = 0; i < FDS_COUNT; ++i) {
@@ -298,8 +325,7 @@ int session_new(struct proc *proc)
     pgrp->session_node = enqueue(session->pgps, pgrp);
     if (!pgrp->session_node) goto e_nomem;
 
-    proc->pgrp_node = enqueue(pgrp->procs, proc);
-    if (!proc->pgrp_node) goto e_nomem;
+    queue_node_append(pgrp->procs, &proc->pgrp_node, proc);
 
     session->sid = proc->pid;
     pgrp->pgid = proc->pid;
@@ -339,18 +365,16 @@ int pgrp_new(struct proc *proc, struct pgroup **ref)
     pgrp->pgid = proc->pid;
     pgrp->session = proc->pgrp->session;
 
-    /* remove the process from the old process group */
-    queue_node_remove(proc->pgrp->procs, proc->pgrp_node);
-
     pgrp->procs = queue_new();
     if (!pgrp->procs) goto e_nomem;
 
-    proc->pgrp_node = enqueue(pgrp->procs, proc);
-    if (!proc->pgrp_node) goto e_nomem;
-
     pgrp->session_node = enqueue(proc->pgrp->session->pgps, pgrp);
     if (!pgrp->session_node) goto e_nomem;
 
+    /* move the process from the old process group */
+    queue_node_unlink(proc->pgrp->procs, &proc->pgrp_node);
+    queue_node_append(pgrp->procs, &proc->pgrp_node, proc);
+
     if (!proc->pgrp->procs->count) {
         /* TODO */
     }
@@ -365,8 +389,10 @@ e_nomem:
     err = -ENOMEM;
 
 error:
-    if (pgrp)
+    if (pgrp) {
+        kfree(pgrp->procs);
         kfree(pgrp);
+    }
 
     return err;
 }
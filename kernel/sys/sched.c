@@ -10,15 +10,23 @@ struct thread *curthread = NULL;
 
 void sched_thread_ready(struct thread *thread)
 {
-    struct qnode *sched_node = enqueue(ready_queue, thread);
+    /* already queued */
+    if (thread->sched_queue)
+        return;
+
+    queue_node_append(ready_queue, &thread->sched_node, thread);
     thread->sched_queue = ready_queue;
-    thread->sched_node  = sched_node;
 }
 
 int kidle = 0;
 void kernel_idle(void)
 {
     kidle = 1;
+
+    /* nothing else to do, give cached heap pages back */
+    kvmem_reclaim(KVMEM_RECLAIM_IDLE_KEEP);
+    mm_zero_pool_fill();
+
     arch_idle();
 }
 
@@ -58,8 +66,8 @@ void schedule() /* Called from arch-specific timer event handler */
     if (!ready_queue->count) /* No ready threads, idle */
         kernel_idle();
 
-    curthread = dequeue(ready_queue);
-    curthread->sched_node = NULL;
+    curthread = queue_node_pop(ready_queue);
+    curthread->sched_queue = NULL;
 
     if (curthread->spawned) {
         arch_thread_switch(curthread);
@@ -30,6 +30,7 @@
 
 #include <fs/devpts.h>
 #include <fs/pipe.h>
+#include <fs/shmfs.h>
 #include <fs/stat.h>
 
 #include <mm/vm.h>
@@ -281,8 +282,21 @@ static void sys_sbrk(ptrdiff_t incr)
     uintptr_t heap_start = curproc->heap_start;
     uintptr_t heap = curproc->heap;
 
+    size_t size = PAGE_ROUND(heap + incr - heap_start);
+    int err = 0;
+
+    if (size > curproc->heap_vm->size)
+        err = proc_as_check(curproc, size - curproc->heap_vm->size);
+
+    if (!err)
+        err = vm_space_resize(&curproc->vm_space, curproc->heap_vm, size);
+
+    if (err) {
+        arch_syscall_return(curthread, err);
+        return;
+    }
+
     curproc->heap = heap + incr;
-    curproc->heap_vm->size = PAGE_ROUND(heap + incr - heap_start);
 
     arch_syscall_return(curthread, heap);
     return;
@@ -764,26 +778,58 @@ struct mmap_args {
     off_t   off;
 } __packed;
 
+/* bytes of [base, base + size) already covered by entries of `vm_space` */
+static size_t mmap_mapped(struct vm_space *vm_space, uintptr_t base, size_t size)
+{
+    uintptr_t end = base + size;
+    size_t mapped = 0;
+
+    vm_space_for (vm_entry, vm_space) {
+        uintptr_t start = MAX(vm_entry->base, base);
+        uintptr_t stop  = MIN(vm_entry->base + vm_entry->size, end);
+
+        if (start < stop)
+            mapped += stop - start;
+    }
+
+    return mapped;
+}
+
 static void sys_mmap(struct mmap_args *args, void **ret)
 {
     syscall_log(LOG_DEBUG, "mmap(addr=%p, len=%d, prot=%x, flags=%x, fildes=%d, off=%d, ret=%p)\n",
             args->addr, args->len, args->prot, args->flags, args->fildes, args->off, ret);
 
     int err = 0;
+    struct file *file = NULL;
+    struct vm_space *vm_space = &curproc->vm_space;
 
-    int fildes = args->fildes;
-    if (fildes < 0 || fildes >= FDS_COUNT) {  /* Out of bounds */
-        arch_syscall_return(curthread, -EBADFD);
-        return; 
+    if (!args->len || ((args->flags & MAP_FIXED) && ((uintptr_t) args->addr & PAGE_MASK))) {
+        arch_syscall_return(curthread, -EINVAL);
+        return;
     }
 
-    struct file *file = &curproc->fds[fildes];
-
-    if (!file->vnode) {    /* Invalid File Descriptor */
-        arch_syscall_return(curthread, -EBADFD);
+    /* length would wrap around when rounded to pages */
+    if (PAGE_ROUND(args->len) < args->len) {
+        arch_syscall_return(curthread, -ENOMEM);
         return;
     }
 
+    if (!(args->flags & MAP_ANONYMOUS)) {
+        int fildes = args->fildes;
+        if (fildes < 0 || fildes >= FDS_COUNT) {  /* Out of bounds */
+            arch_syscall_return(curthread, -EBADFD);
+            return; 
+        }
+
+        file = &curproc->fds[fildes];
+
+        if (!file->vnode) {    /* Invalid File Descriptor */
+            arch_syscall_return(curthread, -EBADFD);
+            return;
+        }
+    }
+
     /* Allocate VMR */
     struct vm_entry *vm_entry;
     vm_entry = vm_entry_new();
@@ -795,24 +841,70 @@ static void sys_mmap(struct mmap_args *args, void **ret)
 
     /* Initialize VM entry */
     vm_entry->base   = (uintptr_t) args->addr;
-    vm_entry->size   = args->len;
+    vm_entry->size   = PAGE_ROUND(args->len);
     vm_entry->flags  = args->prot & PROT_READ  ? VM_UR : 0;
     vm_entry->flags |= args->prot & PROT_WRITE ? VM_UW : 0;
     vm_entry->flags |= args->prot & PROT_EXEC  ? VM_UX : 0;
     vm_entry->flags |= args->flags & MAP_SHARED ? VM_SHARED : 0;
-    vm_entry->off    = args->off;
+    vm_entry->off    = file? args->off : 0;
+
+    if (file) {
+        vm_entry->vm_object = vm_object_vnode(file->vnode);
+    } else if (args->flags & MAP_SHARED) {
+        /* shared anonymous memory lives in an object inherited across fork */
+        vm_entry->vm_object = vm_object_zero();
+    } else {
+        /* private anonymous memory is zero filled by the anon layer on fault */
+        vm_entry->vm_object = NULL;
+    }
+
+    if (file || (args->flags & MAP_SHARED)) {
+        if (!vm_entry->vm_object) {
+            err = -ENOMEM;
+            goto error;
+        }
+
+        /* zero objects are created with a reference */
+        if (file)
+            vm_object_incref(vm_entry->vm_object);
+    }
 
-    vm_entry->vm_object = vm_object_vnode(file->vnode);
+    size_t charge = vm_entry->size;
 
-    if (!(args->flags & MAP_FIXED))
+    if (!(args->flags & MAP_FIXED)) {
         vm_entry->base = 0;  /* Allocate memory region */
+    } else if (vm_entry->base + vm_entry->size < vm_entry->base) {
+        /*
+         * the only way the insert below can fail once the range is free,
+         * check it before anything is unmapped
+         */
+        err = -ENOMEM;
+        goto error;
+    } else {
+        /* only the part not replaced adds to the address space */
+        charge -= mmap_mapped(vm_space, vm_entry->base, vm_entry->size);
+    }
+
+    if ((err = proc_as_check(curproc, charge)))
+        goto error;
+
+    /* fixed mappings replace whatever was there */
+    if ((args->flags & MAP_FIXED) && (err = vm_space_unmap(vm_space, vm_entry->base, vm_entry->size)))
+        goto error;
 
-    struct vm_space *vm_space = &curproc->vm_space;
     if ((err = vm_space_insert(vm_space, vm_entry)))
         goto error;
 
-    if (!(args->flags & MAP_PRIVATE) && (err = vfs_map(vm_space, vm_entry)))
+    if (file && !(args->flags & MAP_PRIVATE) && (err = vfs_map(vm_space, vm_entry))) {
+        /* drop whatever was mapped before the failure */
+        mm_unmap_full(vm_space->pmap, vm_entry->base, vm_entry->size);
+        vm_space_remove(vm_space, vm_entry);
         goto error;
+    }
+
+    /* pay the faults up front, whatever fails is faulted in later */
+    if (args->flags & MAP_POPULATE)
+        mm_populate(vm_space, vm_entry, vm_entry->base, vm_entry->base + vm_entry->size);
 
     *ret = (void *) vm_entry->base;
 
@@ -821,9 +913,7 @@ static void sys_mmap(struct mmap_args *args, void **ret)
 
 error:
     if (vm_entry) {
-        if (vm_entry->qnode)
-            queue_node_remove(&curproc->vm_space.vm_entries, vm_entry->qnode);
-
+        vm_entry_destroy(vm_entry);
         kfree(vm_entry);
     }
 
@@ -837,21 +927,93 @@ static void sys_munmap(void *addr, size_t len)
 
     struct vm_space *vm_space = &curproc->vm_space;
 
-    queue_for (node, &vm_space->vm_entries) {
-        struct vm_entry *vm_entry = node->value;
+    /* entries are split or trimmed to fit the range */
+    int err = vm_space_unmap(vm_space, (uintptr_t) addr, len);
 
-        if (vm_entry->base == (uintptr_t) addr && vm_entry->size == len) {
-            queue_node_remove(&vm_space->vm_entries, vm_entry->qnode);
-            vm_unmap_full(vm_space, vm_entry);
-            kfree(vm_entry);
-            arch_syscall_return(curthread, 0);
-            return;
-        }
+    arch_syscall_return(curthread, err);
+    return;
+}
+
+static void sys_madvise(void *addr, size_t len, int advice)
+{
+    syscall_log(LOG_DEBUG, "madvise(addr=%p, len=%d, advice=%d)\n", addr, len, advice);
+
+    int err = vm_space_advise(&curproc->vm_space, (uintptr_t) addr, len, advice);
+    arch_syscall_return(curthread, err);
+}
+
+static void sys_mlock(const void *addr, size_t len)
+{
+    syscall_log(LOG_DEBUG, "mlock(addr=%p, len=%d)\n", addr, len);
+
+    int err = vm_space_lock(&curproc->vm_space, (uintptr_t) addr, len, 1);
+    arch_syscall_return(curthread, err);
+}
+
+static void sys_munlock(const void *addr, size_t len)
+{
+    syscall_log(LOG_DEBUG, "munlock(addr=%p, len=%d)\n", addr, len);
+
+    int err = vm_space_lock(&curproc->vm_space, (uintptr_t) addr, len, 0);
+    arch_syscall_return(curthread, err);
+}
+
+static void sys_swapon(const char *path)
+{
+    syscall_log(LOG_DEBUG, "swapon(path=%s)\n", path);
+
+    if (curproc->uid != 0) {
+        arch_syscall_return(curthread, -EACCES);
+        return;
     }
 
-    /* Not found */
-    arch_syscall_return(curthread, -EINVAL);
-    return;
+    struct vnode *vnode = NULL;
+    struct uio uio = PROC_UIO(curproc);
+
+    int ret = vfs_lookup(path, &uio, &vnode, NULL);
+
+    if (ret) {
+        arch_syscall_return(curthread, ret);
+        return;
+    }
+
+    /* the swap area keeps the reference */
+    if ((ret = swap_on(vnode)))
+        vfs_close(vnode);
+
+    arch_syscall_return(curthread, ret);
+}
+
+static void sys_getrlimit(int resource, struct rlimit *rlim)
+{
+    syscall_log(LOG_DEBUG, "getrlimit(resource=%d, rlim=%p)\n", resource, rlim);
+
+    if (resource < 0 || resource >= RLIMIT_NLIMITS) {
+        arch_syscall_return(curthread, -EINVAL);
+        return;
+    }
+
+    *rlim = curproc->rlimits[resource];
+    arch_syscall_return(curthread, 0);
+}
+
+static void sys_setrlimit(int resource, const struct rlimit *rlim)
+{
+    syscall_log(LOG_DEBUG, "setrlimit(resource=%d, rlim=%p)\n", resource, rlim);
+
+    if (resource < 0 || resource >= RLIMIT_NLIMITS || rlim->rlim_cur > rlim->rlim_max) {
+        arch_syscall_return(curthread, -EINVAL);
+        return;
+    }
+
+    /* only root may raise the hard limit */
+    if (rlim->rlim_max > curproc->rlimits[resource].rlim_max && curproc->uid != 0) {
+        arch_syscall_return(curthread, -EPERM);
+        return;
+    }
+
+    curproc->rlimits[resource] = *rlim;
+    arch_syscall_return(curthread, 0);
 }
 
 static void sys_socket(int domain, int type, int protocol)
@@ -1231,6 +1393,60 @@ static void sys_rmdir(const char *path)
     arch_syscall_return(curthread, -ENOSYS);
 }
 
+static void sys_shm_open(const char *name, int oflags, mode_t mode)
+{
+    syscall_log(LOG_DEBUG, "shm_open(name=%s, oflags=0x%x, mode=0x%x)\n", name, oflags, mode);
+
+    int fd = proc_fd_get(curproc);  /* Find a free file descriptor */
+
+    if (fd == -1) {
+        /* Reached maximum number of open file descriptors */
+        arch_syscall_return(curthread, -EMFILE);
+        return;
+    }
+
+    struct vnode *vnode = NULL;
+    struct uio uio = PROC_UIO(curproc);
+    uio.flags = oflags;
+
+    /* objects live in the shmfs namespace whether mounted or not */
+    int ret = shmfs_open(name, oflags, mode, &uio, &vnode);
+
+    if (ret)
+        goto done;
+
+    curproc->fds[fd] = (struct file) {
+        .vnode  = vnode,
+        .offset = 0,
+        .flags  = oflags,
+    };
+
+    if ((ret = vfs_perms_check(&curproc->fds[fd], &uio)))
+        goto done;
+
+    ret = vfs_file_open(&curproc->fds[fd]);
+
+done:
+    if (ret < 0) { /* open returned an error code */
+        proc_fd_release(curproc, fd);
+        vfs_close(vnode);
+    } else {
+        ret = fd;
+    }
+
+    arch_syscall_return(curthread, ret);
+    return;
+}
+
+static void sys_shm_unlink(const char *name)
+{
+    syscall_log(LOG_DEBUG, "shm_unlink(name=%s)\n", name);
+
+    struct uio uio = PROC_UIO(curproc);
+    int ret = shmfs_unlink(name, &uio);
+    arch_syscall_return(curthread, ret);
+}
+
 void (*syscall_table[])() =  {
     /* 00 */    NULL,
     /* 01 */    sys_exit,
@@ -1292,6 +1508,14 @@ void (*syscall_table[])() =  {
     /* 57 */    sys_lchown,
     /* 58 */    sys_utime,
     /* 59 */    sys_rmdir,
+    /* 60 */    sys_shm_open,
+    /* 61 */    sys_shm_unlink,
+    /* 62 */    sys_madvise,
+    /* 63 */    sys_mlock,
+    /* 64 */    sys_munlock,
+    /* 65 */    sys_swapon,
+    /* 66 */    sys_getrlimit,
+    /* 67 */    sys_setrlimit,
 };
 
 const size_t syscall_cnt = sizeof(syscall_table)/sizeof(syscall_table[0]);
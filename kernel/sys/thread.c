@@ -5,7 +5,7 @@
 #include <sys/sched.h>
 #include <ds/queue.h>
 
-MALLOC_DEFINE(M_THREAD, "thread", "thread structure");
+MALLOC_DEFINE_CACHE(M_THREAD, "thread", "thread structure", sizeof(struct thread), NULL);
 
 int thread_new(struct proc *proc, struct thread **ref)
 {
@@ -20,7 +20,7 @@ int thread_new(struct proc *proc, struct thread **ref)
     thread->owner = proc;
     thread->tid = proc->threads.count + 1;
 
-    enqueue(&proc->threads, thread);
+    queue_node_append(&proc->threads, &thread->owner_node, thread);
 
     if (ref)
         *ref = thread;
@@ -48,10 +48,9 @@ int thread_queue_sleep(struct queue *queue)
     printk("[%d:%d] %s: Sleeping on queue %p\n", curproc->pid, curthread->tid, curproc->name, queue);
 #endif
 
-    struct qnode *sleep_node = enqueue(queue, curthread);
+    queue_node_append(queue, &curthread->sleep_node, curthread);
 
     curthread->sleep_queue = queue;
-    curthread->sleep_node  = sleep_node;
     curthread->state = ISLEEP;
     arch_sleep();
 
@@ -74,8 +73,8 @@ int thread_queue_wakeup(struct queue *queue)
         return -EINVAL;
 
     while (queue->count) {
-        struct thread *thread = dequeue(queue);
-        thread->sleep_node = NULL;
+        struct thread *thread = queue_node_pop(queue);
+        thread->sleep_queue = NULL;
 #ifdef DEBUG_SLEEP_QUEUE
         printk("[%d:%d] %s: Waking up from queue %p\n", thread->owner->pid, thread->tid, thread->owner->name, queue);
 #endif
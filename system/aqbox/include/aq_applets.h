@@ -26,6 +26,7 @@ int cmd_truncate(int, char**);
 int cmd_mktemp(int, char**);
 int cmd_vmstat(int, char**);
 int cmd_date(int, char**);
+int cmd_swapon(int, char**);
 
 #define APPLET(name) {#name, cmd_##name}
 
@@ -53,6 +54,7 @@ struct applet {
     APPLET(reboot),
     APPLET(sh),
     APPLET(stat),
+    APPLET(swapon),
     APPLET(touch),
     APPLET(truncate),
     APPLET(uname),
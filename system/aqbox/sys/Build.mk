@@ -2,3 +2,4 @@ obj-y += mount.o
 obj-y += login.o
 obj-y += getty.o
 obj-y += reboot.o
+obj-y += swapon.o
@@ -0,0 +1,30 @@
+#include <aqbox.h>
+#include <stdio.h>
+#include <string.h>
+
+/* the C library has no wrapper for it */
+#define SYS_SWAPON  65
+
+static int sys_swapon(const char *path)
+{
+    int ret;
+    asm volatile ("int $0x80" : "=a"(ret) : "a"(SYS_SWAPON), "b"(path) : "memory");
+    return ret;
+}
+
+AQBOX_APPLET(swapon)(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s device|file\n", argv[0]);
+        return -1;
+    }
+
+    int err = sys_swapon(argv[1]);
+
+    if (err < 0) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(-err));
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Host-side microbenchmark for kernel/include/ds/hashmap.h
+ *
+ * Fills a hashmap with the kinds of keys the kernel hashes (page
+ * offsets, block numbers and inode numbers, sized as on i386) and
+ * compares the byte sum digest the hashmap used to have with the
+ * current FNV-1a digest: bucket usage, chain lengths and lookup time.
+ *
+ * usage: hashbench [keys]
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+/* the kernel header, its own includes resolve to the stubs in include/ */
+#include "../../kernel/include/ds/hashmap.h"
+
+MALLOC_DEFINE(M_HASHMAP, "hashmap");
+
+#define PAGE_SIZE   4096
+#define ROUNDS      64
+
+/* the digest before FNV-1a, sums the key bytes */
+static hash_t sum_digest(const void *_id, size_t size)
+{
+    const char *id = (const char *) _id;
+
+    hash_t hash = 0;
+
+    while (size) {
+        hash += *id;
+        ++id;
+        --size;
+    }
+
+    return hash;
+}
+
+static const struct digest {
+    const char *name;
+    hash_t (*fn)(const void *id, size_t size);
+} digests[] = {
+    {"sum",     sum_digest},
+    {"fnv1a",   hashmap_digest},
+};
+
+struct elem {
+    uint64_t key;
+    struct hashmap_node node;
+};
+
+struct keyset {
+    const char *name;
+    size_t size;    /* bytes digested, as sizeof the kernel type */
+    uint64_t (*key)(size_t i);
+};
+
+/* vm_object page offsets (size_t) */
+static uint64_t page_off(size_t i)
+{
+    return (uint64_t) i * PAGE_SIZE;
+}
+
+/* minix zone numbers as passed to bcache (uint64_t) */
+static uint64_t block_nr(size_t i)
+{
+    return i + 1;
+}
+
+/* ext2 inode numbers (ino_t), spread over block groups of 2048 inodes */
+static uint64_t inode_nr(size_t i)
+{
+    return (i % 8) * 2048 + i / 8 + 1;
+}
+
+static const struct keyset keysets[] = {
+    {"page offsets",  sizeof(uint32_t), page_off},
+    {"block numbers", sizeof(uint64_t), block_nr},
+    {"inode numbers", sizeof(uint32_t), inode_nr},
+};
+
+static int elem_eq(struct hashmap_node *node, void *key)
+{
+    return hashmap_entry(node, struct elem, node)->key == *(uint64_t *) key;
+}
+
+static hash_t key_hash(const struct keyset *ks, const struct digest *dg, uint64_t key)
+{
+    /* little endian, the low bytes hold the narrower types */
+    return dg->fn(&key, ks->size);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int run(const struct keyset *ks, const struct digest *dg, size_t nr)
+{
+    struct hashmap *hashmap = hashmap_new(0, elem_eq);
+    struct elem *elems = calloc(nr, sizeof(struct elem));
+
+    if (!hashmap || !elems) {
+        fprintf(stderr, "hashbench: out of memory\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < nr; ++i) {
+        elems[i].key = ks->key(i);
+        hashmap_insert(hashmap, key_hash(ks, dg, elems[i].key), &elems[i].node);
+    }
+
+    /* chain statistics */
+    size_t empty = 0, longest = 0, probes = 0;
+
+    for (size_t b = 0; b < hashmap->buckets_nr; ++b) {
+        size_t len = 0;
+
+        for (struct hashmap_node *node = hashmap->buckets[b]; node; node = node->next)
+            probes += ++len;
+
+        empty += !len;
+        longest = MAX(longest, len);
+    }
+
+    /* successful lookups of every key */
+    size_t found = 0;
+    double start = now_ns();
+
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < nr; ++i) {
+            uint64_t key = elems[i].key;
+            found += !!hashmap_lookup(hashmap, key_hash(ks, dg, key), &key);
+        }
+    }
+
+    double ns = (now_ns() - start) / (ROUNDS * nr);
+
+    if (found != ROUNDS * nr) {
+        fprintf(stderr, "hashbench: %s/%s: lost keys\n", ks->name, dg->name);
+        return -1;
+    }
+
+    printf("%-14s %-6s %8zu %6.1f%% %8zu %9.2f %10.1f\n", ks->name, dg->name,
+            hashmap->buckets_nr, 100.0 * empty / hashmap->buckets_nr, longest,
+            (double) probes / nr, ns);
+
+    hashmap_free(hashmap);
+    free(elems);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nr = argc > 1? strtoul(argv[1], NULL, 0) : 4096;
+
+    if (!nr) {
+        fprintf(stderr, "usage: %s [keys]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%zu keys, %d lookup rounds\n\n", nr, ROUNDS);
+    printf("%-14s %-6s %8s %7s %8s %9s %10s\n", "keys", "digest", "buckets",
+            "empty", "longest", "avg probe", "ns/lookup");
+
+    for (size_t k = 0; k < sizeof(keysets) / sizeof(keysets[0]); ++k) {
+        for (size_t d = 0; d < sizeof(digests) / sizeof(digests[0]); ++d) {
+            if (run(&keysets[k], &digests[d], nr))
+                return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+#ifndef _BITS_ERRNO_H
+#define _BITS_ERRNO_H
+
+/* the host <errno.h> includes <bits/errno.h> itself, don't go through it */
+#define EINVAL  22
+
+#endif /* ! _BITS_ERRNO_H */
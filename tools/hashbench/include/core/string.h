@@ -0,0 +1,6 @@
+#ifndef _CORE_STRING_H
+#define _CORE_STRING_H
+
+#include <string.h>
+
+#endif /* ! _CORE_STRING_H */
@@ -0,0 +1,39 @@
+#ifndef _CORE_SYSTEM_H
+#define _CORE_SYSTEM_H
+
+/*
+ * Host stand-in for the kernel's core/system.h, just enough for the
+ * header-only data structures in kernel/include/ds: kmalloc and kfree
+ * map onto the C library allocator.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define M_ZERO  0x0001
+
+struct malloc_type {
+    const char *name;
+};
+
+#define MALLOC_DECLARE(type) extern struct malloc_type (type)
+#define MALLOC_DEFINE(type, name) struct malloc_type (type) = {(name)}
+
+MALLOC_DECLARE(M_HASHMAP);
+
+static inline void *kmalloc(size_t size, struct malloc_type *type, int flags)
+{
+    (void) type;
+    return (flags & M_ZERO)? calloc(1, size) : malloc(size);
+}
+
+static inline void kfree(void *ptr)
+{
+    free(ptr);
+}
+
+#endif /* ! _CORE_SYSTEM_H */